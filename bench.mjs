@@ -0,0 +1,61 @@
+#!/usr/bin/env node
+// =============================================================================
+// Transpile-time benchmark
+//
+//   node bench.mjs [--runs 10] [--budget ms] [examples/chess.wasm ...]
+//
+// Parses (as main.js does: only bodies reachable from mainImage) and
+// transpiles each module, default every examples/*.wasm, and reports the
+// median and best time of each step over several runs after one warm-up.
+// With --budget, exits with status 1 when a module's median transpile time
+// is over that many milliseconds, so that a slow pass fails a check.
+// =============================================================================
+
+import { readFileSync, readdirSync } from 'fs';
+import { WasmParser } from './wasm-parser.js';
+import { generateComputeShader } from './transpiler.js';
+
+const args = process.argv.slice(2);
+const runsAt = args.indexOf('--runs');
+const runs = runsAt < 0 ? 10 : +args.splice(runsAt, 2)[1];
+const budgetAt = args.indexOf('--budget');
+const budget = budgetAt < 0 ? Infinity : +args.splice(budgetAt, 2)[1];
+const files = args.length ? args : readdirSync('examples').filter(f => f.endsWith('.wasm')).sort().map(f => `examples/${f}`);
+
+const median = xs => [...xs].sort((a, b) => a - b)[xs.length >> 1];
+const ms = x => `${x.toFixed(2).padStart(8)} ms`;
+
+// Transpiler warnings would repeat once per run
+const warn = console.warn;
+console.warn = () => {};
+
+console.log(`${'module'.padEnd(24)}${'bytes'.padStart(8)}   parse (median / best)      transpile (median / best)   WGSL lines`);
+let totalParse = 0, totalTranspile = 0;
+const over = [];
+for (const file of files) {
+  const buf = readFileSync(file);
+  const buffer = buf.buffer.slice(buf.byteOffset, buf.byteOffset + buf.byteLength);
+  const parse = [], transpile = [];
+  let lines = 0;
+  for (let i = 0; i <= runs; i++) {
+    const t0 = performance.now();
+    const wasm = new WasmParser(buffer).parse({ roots: ['mainImage'] });
+    const t1 = performance.now();
+    const { code } = generateComputeShader(wasm);
+    const t2 = performance.now();
+    if (i === 0) { lines = code.split('\n').length; continue; } // warm-up
+    parse.push(t1 - t0);
+    transpile.push(t2 - t1);
+  }
+  totalParse += median(parse);
+  totalTranspile += median(transpile);
+  if (median(transpile) > budget) over.push(file);
+  console.log(`${file.replace(/^.*\//, '').padEnd(24)}${String(buf.byteLength).padStart(8)}   ` +
+    `${ms(median(parse))} / ${ms(Math.min(...parse))}   ${ms(median(transpile))} / ${ms(Math.min(...transpile))}   ${lines}`);
+}
+console.warn = warn;
+console.log(`${'total (medians)'.padEnd(32)}   ${ms(totalParse)}${' '.repeat(16)}${ms(totalTranspile)}`);
+if (over.length) {
+  console.error(`over the ${budget} ms transpile budget: ${over.join(', ')}`);
+  process.exitCode = 1;
+}
@@ -8,6 +8,9 @@
 #   brew install llvm
 #   brew install emscripten
 #   export WASM_LLVM_BIN=/path/to/llvm/bin  (directory with clang + wasm-ld)
+#
+# Extra compiler flags come from WASM_CFLAGS, e.g. WASM_CFLAGS=-g keeps the
+# DWARF line table that the transpiler's source map reads.
 set -euo pipefail
 
 SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
@@ -38,7 +41,7 @@ if [ -n "$LLVM_BIN" ]; then
   OBJ="${SRC%.*}.o"
   CLANG="$LLVM_BIN/clang"
   case "$SRC" in *.cpp|*.cc|*.cxx) CLANG="$LLVM_BIN/clang++" ;; esac
-  "$CLANG" --target=wasm32 -O2 -c -fno-exceptions -fno-rtti -I"$SCRIPT_DIR" "$SRC" -o "$OBJ"
+  "$CLANG" --target=wasm32 -O2 -c -fno-exceptions -fno-rtti ${WASM_CFLAGS:-} -I"$SCRIPT_DIR" "$SRC" -o "$OBJ"
   "$LLVM_BIN/wasm-ld" \
     --no-entry \
     --allow-undefined \
@@ -69,7 +72,7 @@ fi
 
 if [ -n "$EMCC" ]; then
   echo "Using emcc: $EMCC (note: math imports will be resolved, not preserved)"
-  "$EMCC" -O2 \
+  "$EMCC" -O2 ${WASM_CFLAGS:-} \
     --no-entry \
     -s EXPORTED_FUNCTIONS='["_mainImage"]' \
     -s STANDALONE_WASM \
@@ -1,29 +1,63 @@
 // =============================================================================
 // WebGPU init + render loop — uses dynamically generated compute shader
+// (or, for the fragment target, draws the generated fragment shader directly)
 // =============================================================================
 
+// Workgroups of a persistent shader: enough to keep a large GPU's compute
+// units busy; more only queue up behind the others
+const PERSISTENT_WORKGROUPS = 256;
+
 async function loadShader(url) {
   const res = await fetch(url);
   return res.text();
 }
 
-export async function initGPU(canvas, computeSrc) {
+// shader: result of generateComputeShader() or generateFragmentShader() —
+// { code, frameSize, specialized, supersampled, persistent, target, rodata, entryPoints, blocks }
+// options.heatmap: for an instrumented shader, draw each pixel's loop
+// iteration count over the image (heatmap.wgsl)
+// options.samples, options.maxSamples: for a supersampled shader, the samples
+// per pixel to start with (default 1) and the most that gpu.samples may be
+// set to later (default options.samples); the output buffer holds that many
+// planes, so both are capped at what the device can bind — above the default
+// limits only when the adapter offers more
+// options.workgroups: for a persistent shader, how many workgroups pull
+// tiles from its queue (default PERSISTENT_WORKGROUPS)
+export async function initGPU(canvas, shader, options = {}) {
   const width = canvas.width;
   const height = canvas.height;
+  const fragment = shader.target === 'fragment';
+  const planeSize = width * height * 4 * 4;
+  let samples = shader.supersampled ? Math.max(1, options.samples ?? 1) : 1;
+  let maxSamples = shader.supersampled ? Math.max(samples, options.maxSamples ?? samples) : 1;
 
   if (!navigator.gpu) throw new Error('WebGPU not supported');
   const adapter = await navigator.gpu.requestAdapter();
   if (!adapter) throw new Error('No WebGPU adapter found');
-  const device = await adapter.requestDevice();
+  const device = await adapter.requestDevice(maxSamples > 1 ? {
+    requiredLimits: {
+      maxStorageBufferBindingSize: Math.min(planeSize * maxSamples, adapter.limits.maxStorageBufferBindingSize),
+      maxBufferSize: Math.min(planeSize * maxSamples, adapter.limits.maxBufferSize),
+    },
+  } : undefined);
+  const fits = Math.max(1, Math.floor(Math.min(device.limits.maxStorageBufferBindingSize, device.limits.maxBufferSize) / planeSize));
+  if (maxSamples > fits) {
+    console.warn(`${maxSamples} sample planes exceed the device's buffer limits; using ${fits}`);
+    maxSamples = fits;
+    samples = Math.min(samples, fits);
+  }
   const ctx = canvas.getContext('webgpu');
   const format = navigator.gpu.getPreferredCanvasFormat();
   ctx.configure({ device, format, alphaMode: 'opaque' });
 
-  const renderSrc = await loadShader('render.wgsl');
+  const heatmap = !!(shader.blocks && options.heatmap);
+  const renderSrc = fragment ? null : await loadShader(heatmap ? 'heatmap.wgsl' : 'render.wgsl');
 
-  // Only two buffers needed — no bytecode, no targets, no function table
-  const outputBuffer = device.createBuffer({
-    size: width * height * 4 * 4,
+  // Only two buffers needed — no bytecode, no targets, no function table.
+  // A supersampled shader writes one plane per sample; render.wgsl averages them.
+  // The fragment target writes the swap chain itself and needs no output buffer.
+  const outputBuffer = fragment ? null : device.createBuffer({
+    size: planeSize * maxSamples,
     usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_SRC,
   });
 
@@ -32,16 +66,78 @@ export async function initGPU(canvas, computeSrc) {
     usage: GPUBufferUsage.UNIFORM | GPUBufferUsage.COPY_DST,
   });
 
-  // Compute pipeline (from transpiled WGSL)
-  const computeModule = device.createShaderModule({ code: computeSrc });
-  const computePipeline = device.createComputePipeline({
-    layout: 'auto',
-    compute: { module: computeModule, entryPoint: 'main' },
+  // Uniform-only values, written by the prologue entry point once per frame
+  const frameBuffer = shader.frameSize > 0 ? device.createBuffer({
+    size: shader.frameSize,
+    usage: GPUBufferUsage.STORAGE,
+  }) : null;
+
+  // Data segments too large to inline as WGSL constants
+  const rodataBuffer = shader.rodata ? device.createBuffer({
+    size: shader.rodata.byteLength,
+    usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST,
+  }) : null;
+  if (rodataBuffer) device.queue.writeBuffer(rodataBuffer, 0, shader.rodata);
+
+  // Instrumented shaders: per-pixel loop iterations (a plane per sample, like
+  // the output), and the frame's largest count followed by one execution
+  // count per block; cleared every frame
+  const heatBuffer = shader.blocks ? device.createBuffer({
+    size: width * height * 4 * maxSamples,
+    usage: GPUBufferUsage.STORAGE,
+  }) : null;
+  const countersBuffer = shader.blocks ? device.createBuffer({
+    size: (shader.blocks.length + 1) * 4,
+    usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_SRC | GPUBufferUsage.COPY_DST,
+  }) : null;
+  const countersReadback = shader.blocks ? device.createBuffer({
+    size: (shader.blocks.length + 1) * 4,
+    usage: GPUBufferUsage.MAP_READ | GPUBufferUsage.COPY_DST,
+  }) : null;
+
+  // Persistent shaders: the index of the next tile to shade, zeroed every frame
+  const queueBuffer = shader.persistent ? device.createBuffer({
+    size: 4,
+    usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST,
+  }) : null;
+
+  // Compute pipelines (from transpiled WGSL). Every entry point shares one
+  // bind group; a resolution-specialized shader gets the canvas size as its
+  // overrides. That size is fixed here, as the buffers are sized from it: a
+  // canvas that resizes needs a new initGPU(), so there is nothing to cache
+  // per size. Pipelines for all image functions are created together, so
+  // switching between them (gpu.entry) never waits for a compile. For the
+  // fragment target `main` is a render pipeline of the same module, whose
+  // prologues stay compute entry points.
+  const computeModule = device.createShaderModule({ code: shader.code });
+  const visibility = fragment ? GPUShaderStage.COMPUTE | GPUShaderStage.FRAGMENT : GPUShaderStage.COMPUTE;
+  const computeLayout = device.createBindGroupLayout({
+    entries: [
+      ...(outputBuffer ? [{ binding: 0, visibility, buffer: { type: 'storage' } }] : []),
+      { binding: 1, visibility, buffer: { type: 'uniform' } },
+      ...(frameBuffer ? [{ binding: 2, visibility, buffer: { type: 'storage' } }] : []),
+      ...(rodataBuffer ? [{ binding: 3, visibility, buffer: { type: 'read-only-storage' } }] : []),
+      ...(heatBuffer ? [4, 5].map(binding => ({ binding, visibility: GPUShaderStage.COMPUTE, buffer: { type: 'storage' } })) : []),
+      ...(queueBuffer ? [{ binding: 6, visibility: GPUShaderStage.COMPUTE, buffer: { type: 'storage' } }] : []),
+    ],
+  });
+  const computePipelineLayout = device.createPipelineLayout({ bindGroupLayouts: [computeLayout] });
+  const constants = shader.specialized ? { RES_W: width, RES_H: height } : undefined;
+  const create = entryPoint => device.createComputePipeline({
+    layout: computePipelineLayout,
+    compute: { module: computeModule, entryPoint, constants },
   });
+  const draw = entryPoint => device.createRenderPipeline({
+    layout: computePipelineLayout,
+    vertex: { module: computeModule, entryPoint: 'vs' },
+    fragment: { module: computeModule, entryPoint, constants, targets: [{ format }] },
+    primitive: { topology: 'triangle-list' },
+  });
+  const computePipelines = shader.entryPoints.map(ep => ({ main: (fragment ? draw : create)(ep.main), prologue: ep.prologue && create(ep.prologue) }));
 
-  // Render pipeline
-  const renderModule = device.createShaderModule({ code: renderSrc });
-  const renderPipeline = device.createRenderPipeline({
+  // Render pipeline that shows the output buffer
+  const renderModule = fragment ? null : device.createShaderModule({ code: renderSrc });
+  const renderPipeline = fragment ? null : device.createRenderPipeline({
     layout: 'auto',
     vertex: { module: renderModule, entryPoint: 'vs' },
     fragment: { module: renderModule, entryPoint: 'fs', targets: [{ format }] },
@@ -49,43 +145,70 @@ export async function initGPU(canvas, computeSrc) {
   });
 
   const computeBindGroup = device.createBindGroup({
-    layout: computePipeline.getBindGroupLayout(0),
+    layout: computeLayout,
     entries: [
-      { binding: 0, resource: { buffer: outputBuffer } },
+      ...(outputBuffer ? [{ binding: 0, resource: { buffer: outputBuffer } }] : []),
       { binding: 1, resource: { buffer: uniformBuffer } },
+      ...(frameBuffer ? [{ binding: 2, resource: { buffer: frameBuffer } }] : []),
+      ...(rodataBuffer ? [{ binding: 3, resource: { buffer: rodataBuffer } }] : []),
+      ...(heatBuffer ? [{ binding: 4, resource: { buffer: heatBuffer } }, { binding: 5, resource: { buffer: countersBuffer } }] : []),
+      ...(queueBuffer ? [{ binding: 6, resource: { buffer: queueBuffer } }] : []),
     ],
   });
 
-  const renderBindGroup = device.createBindGroup({
+  const renderBindGroup = fragment ? null : device.createBindGroup({
     layout: renderPipeline.getBindGroupLayout(0),
     entries: [
       { binding: 0, resource: { buffer: outputBuffer } },
       { binding: 1, resource: { buffer: uniformBuffer } },
+      ...(heatmap ? [{ binding: 2, resource: { buffer: heatBuffer } }, { binding: 3, resource: { buffer: countersBuffer } }] : []),
     ],
   });
 
   return {
     device, ctx, uniformBuffer,
-    computePipeline, computeBindGroup,
+    computePipelines, computeBindGroup,
     renderPipeline, renderBindGroup,
+    countersBuffer, countersReadback, queueBuffer, fragment,
+    workgroups: queueBuffer ? options.workgroups ?? PERSISTENT_WORKGROUPS : 0,
     width, height,
+    entryPoints: shader.entryPoints,
+    entry: 0, // index into entryPoints of the image function drawn; may be changed at any time
+    samples, maxSamples, // samples per pixel, up to maxSamples; may be changed at any time
   };
 }
 
-export function startRenderLoop(gpu) {
+// onCounters(counts): for an instrumented shader, called about once a second
+// with a frame's counters — counts[0] the largest per-pixel loop iteration
+// count, counts[1 + k] the executions of block k
+export function startRenderLoop(gpu, onCounters = null) {
   const {
     device, ctx, uniformBuffer,
-    computePipeline, computeBindGroup,
+    computePipelines, computeBindGroup,
     renderPipeline, renderBindGroup,
+    countersBuffer, countersReadback, queueBuffer, fragment, workgroups,
     width, height,
   } = gpu;
 
   let lastTime = performance.now();
   let frameCount = 0;
   let fps = 0;
+  // Uniforms and entry point of the last dispatch; an image function that
+  // ignores iTime is only re-dispatched when the others change.
+  let rendered = null;
+  let readCounters = true; // copy this frame's counters for onCounters
 
   async function render() {
     const time = performance.now() / 1000;
+    const entry = gpu.entry;
+    const samples = Math.min(Math.max(1, gpu.samples | 0), gpu.maxSamples);
+    const { timeDependent } = gpu.entryPoints[entry];
+    const key = `${width}x${height}:${entry}:${samples}`;
+    if (!timeDependent && rendered === key) {
+      requestAnimationFrame(render);
+      return;
+    }
+    rendered = key;
     const frameStart = performance.now();
 
     const buf = new ArrayBuffer(16);
@@ -94,16 +217,32 @@ export function startRenderLoop(gpu) {
     fv[0] = time;
     fv[1] = width;
     fv[2] = height;
-    uv[3] = 0;
+    uv[3] = samples;
     device.queue.writeBuffer(uniformBuffer, 0, buf);
 
     const encoder = device.createCommandEncoder();
+    if (countersBuffer) encoder.clearBuffer(countersBuffer);
+    if (queueBuffer) encoder.clearBuffer(queueBuffer);
 
-    const computePass = encoder.beginComputePass();
-    computePass.setPipeline(computePipeline);
-    computePass.setBindGroup(0, computeBindGroup);
-    computePass.dispatchWorkgroups(Math.ceil(width / 8), Math.ceil(height / 8));
-    computePass.end();
+    const pipelines = computePipelines[entry];
+    if (!fragment || pipelines.prologue) {
+      const computePass = encoder.beginComputePass();
+      computePass.setBindGroup(0, computeBindGroup);
+      if (pipelines.prologue) {
+        computePass.setPipeline(pipelines.prologue);
+        computePass.dispatchWorkgroups(1);
+      }
+      if (!fragment) {
+        computePass.setPipeline(pipelines.main);
+        if (queueBuffer) {
+          // A fixed set of workgroups; each keeps taking 8x8 tiles until none are left
+          computePass.dispatchWorkgroups(Math.min(workgroups, Math.ceil(width / 8) * Math.ceil(height / 8) * samples));
+        } else {
+          computePass.dispatchWorkgroups(Math.ceil(width / 8), Math.ceil(height / 8), samples);
+        }
+      }
+      computePass.end();
+    }
 
     const renderPass = encoder.beginRenderPass({
       colorAttachments: [{
@@ -113,25 +252,46 @@ export function startRenderLoop(gpu) {
         storeOp: 'store',
       }],
     });
-    renderPass.setPipeline(renderPipeline);
-    renderPass.setBindGroup(0, renderBindGroup);
-    renderPass.draw(6);
+    if (fragment) {
+      // One full-screen triangle; its fragment shader is the image function
+      renderPass.setPipeline(pipelines.main);
+      renderPass.setBindGroup(0, computeBindGroup);
+      renderPass.draw(3);
+    } else {
+      renderPass.setPipeline(renderPipeline);
+      renderPass.setBindGroup(0, renderBindGroup);
+      renderPass.draw(6);
+    }
     renderPass.end();
 
+    const readback = countersBuffer && onCounters && readCounters;
+    if (readback) {
+      encoder.copyBufferToBuffer(countersBuffer, 0, countersReadback, 0, countersBuffer.size);
+      readCounters = false;
+    }
+
     device.queue.submit([encoder.finish()]);
     await device.queue.onSubmittedWorkDone();
 
     const frameTime = performance.now() - frameStart;
 
+    if (readback) {
+      await countersReadback.mapAsync(GPUMapMode.READ);
+      const counts = new Uint32Array(countersReadback.getMappedRange().slice(0));
+      countersReadback.unmap();
+      onCounters(counts);
+    }
+
     frameCount++;
     const now = performance.now();
     if (now - lastTime >= 1000) {
       fps = frameCount;
       frameCount = 0;
       lastTime = now;
+      readCounters = true;
     }
 
-    document.getElementById('fps').textContent = `FPS: ${fps}`;
+    document.getElementById('fps').textContent = timeDependent ? `FPS: ${fps}` : 'Static: rendered on change only';
     document.getElementById('frametime').textContent = `Frame: ${frameTime.toFixed(2)}ms`;
     document.getElementById('time').textContent = `Time: ${time.toFixed(2)}s`;
 
@@ -0,0 +1,55 @@
+// Heatmap overlay for instrumented shaders: each pixel's loop iteration
+// count, relative to the largest in the frame, over the dimmed image. A
+// supersampled shader writes one plane of both per sample: their average
+
+struct Uniforms {
+  time: f32,
+  width: f32,
+  height: f32,
+  samples: u32,
+}
+
+@group(0) @binding(0) var<storage, read> pixels: array<f32>;
+@group(0) @binding(1) var<uniform> uniforms: Uniforms;
+@group(0) @binding(2) var<storage, read> heat: array<u32>;
+@group(0) @binding(3) var<storage, read> counters: array<u32>;
+
+struct VOut {
+  @builtin(position) pos: vec4<f32>,
+  @location(0) uv: vec2<f32>,
+}
+
+@vertex
+fn vs(@builtin(vertex_index) i: u32) -> VOut {
+  var p = array<vec2<f32>, 6>(
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),
+    vec2(-1.0,  1.0), vec2(1.0, -1.0), vec2(1.0,  1.0)
+  );
+  var o: VOut;
+  o.pos = vec4(p[i], 0.0, 1.0);
+  o.uv = p[i] * 0.5 + 0.5;
+  return o;
+}
+
+// Blue (few iterations) → green → yellow → red (the most)
+fn ramp(t: f32) -> vec3<f32> {
+  return clamp(vec3(2.0 * t - 0.5, 2.0 - abs(4.0 * t - 2.0), 1.5 - 3.0 * t), vec3(0.0), vec3(1.0));
+}
+
+@fragment
+fn fs(@location(0) uv: vec2<f32>) -> @location(0) vec4<f32> {
+  let x = u32(uv.x * uniforms.width);
+  let y = u32((1.0 - uv.y) * uniforms.height);
+  let W = u32(uniforms.width);
+  let plane = W * u32(uniforms.height);
+  let n = max(uniforms.samples, 1u);
+  var image = vec3(0.0);
+  var steps = 0.0;
+  for (var s = 0u; s < n; s++) {
+    let idx = (s * plane + y * W + x) * 4u;
+    image += vec3(pixels[idx], pixels[idx + 1u], pixels[idx + 2u]);
+    steps += f32(heat[s * plane + y * W + x]);
+  }
+  let t = steps / f32(n) / max(f32(counters[0]), 1.0);
+  return vec4(mix(image / f32(n) * 0.5, ramp(t), 0.6), 1.0);
+}
@@ -1,5 +1,6 @@
 import { WasmParser } from './wasm-parser.js';
-import { generateComputeShader } from './transpiler.js';
+import { generateComputeShader, generateFragmentShader } from './transpiler.js';
+import { minifyWGSL } from './wgsl-minify.js';
 import { initGPU, startRenderLoop } from './gpu.js';
 
 const infoEl = document.getElementById('info');
@@ -10,29 +11,98 @@ try {
   const wasmFile = params.get('wasm') || 'examples/shader.wasm';
   const response = await fetch(wasmFile);
   const wasmBuffer = await response.arrayBuffer();
-  const wasm = new WasmParser(wasmBuffer).parse();
+  // ?entry=effectA,effectB: image functions to build into the one shader;
+  // clicking the canvas switches between them
+  const entryPoints = params.get('entry')?.split(',') ?? ['mainImage'];
+  // ?lib=a.wasm,b.wasm: libraries that serve mainImage's imports (see README).
+  // Only the shader bodies that the entry points can call are decoded.
+  const libs = params.get('lib') ? await Promise.all(params.get('lib').split(',').map(async f => (await fetch(f)).arrayBuffer())) : [];
+  const wasm = WasmParser.parseAll([wasmBuffer, ...libs], { roots: entryPoints });
 
   // 2. Transpile WASM → native WGSL (no interpreter!)
-  const computeSrc = generateComputeShader(wasm);
-  const lineCount = computeSrc.split('\n').length;
+  // ?specialize: bake the canvas size into the pipeline (fixed-size displays)
+  // ?instrument: count block executions and show loop iterations per pixel
+  // ?profile=examples/chess.profile.json: profile-guided (see profile.mjs)
+  // ?fastmath: divide by constants as a multiply even when not exact
+  // ?persistent: a fixed set of workgroups pulls tiles from a queue
+  // ?samples=4: supersample with one invocation per sample; - and + change
+  // the count while running, between 1 and the requested count
+  // ?compute: go through the compute pass and output buffer even when the
+  // fragment target would do (it can't with ?instrument, ?persistent or ?samples)
+  const instrument = params.has('instrument');
+  const profile = params.get('profile') ? await (await fetch(params.get('profile'))).json() : null;
+  const samples = params.has('samples') ? Math.max(1, +params.get('samples') || 4) : 0;
+  const persistent = params.has('persistent');
+  const compute = instrument || samples > 0 || persistent || params.has('compute');
+  const shader = (compute ? generateComputeShader : generateFragmentShader)(wasm, {
+    specializeResolution: params.has('specialize'), instrument, profile, entryPoints, supersample: samples > 0,
+    persistent, fastMath: params.has('fastmath'),
+  });
+  const lineCount = shader.code.split('\n').length;
+  // ?minify: hand the driver the minified source
+  let sizeInfo = '';
+  if (params.has('minify')) {
+    const min = minifyWGSL(shader.code);
+    shader.code = min.code;
+    sizeInfo = `Minified ${min.before.toLocaleString()} → ${min.after.toLocaleString()} bytes | `;
+  }
+  const computeSrc = shader.code;
 
-  console.log('=== Generated WGSL compute shader ===');
+  console.log(`=== Generated WGSL ${shader.target} shader ===`);
   console.log(computeSrc);
+  console.log('=== Static cost per invocation ===');
+  console.log(shader.report);
+  if (!params.has('minify')) {
+    const mapped = shader.sourceMap.filter(Boolean);
+    console.log(`=== Source map: ${mapped.length} of ${lineCount} lines from WASM` +
+      `${mapped.some(m => m.file) ? ', with C++ lines' : ' (no .debug_line)'} ===`);
+    console.log(shader.sourceMap);
+  }
+  const r = shader.report;
+  const costInfo = `ALU ${r.alu.total}, transcendental ${r.transcendental.total}, ` +
+    `mem ${r.mem.loads} loads / ${r.mem.stores} stores, max live ${r.maxLive}, ` +
+    `${r.loops.count} loops (depth ${r.loops.maxDepth}), ${r.cfJumps} cf jumps, ` +
+    `${(r.privateBytes / 1024).toFixed(1)} KiB private`;
 
   const canvas = document.getElementById('canvas');
   canvas.width = canvas.clientWidth * devicePixelRatio;
   canvas.height = canvas.clientHeight * devicePixelRatio;
   infoEl.textContent =
     `Loaded ${wasmBuffer.byteLength} bytes of WASM | ` +
-    `Transpiled to ${lineCount} lines of native WGSL | ` +
+    `Transpiled to ${lineCount} lines of native WGSL (${costInfo}) | ` +
+    sizeInfo +
     `No interpreter loop — pure GPU instructions | ` +
     `${canvas.width}x${canvas.height} = ${(canvas.width * canvas.height).toLocaleString()} pixels/frame`;
 
   // 3. Initialise WebGPU with the generated shader
-  const gpu = await initGPU(canvas, computeSrc);
+  const gpu = await initGPU(canvas, shader, { heatmap: instrument, samples });
 
-  // 4. Go
-  startRenderLoop(gpu);
+  if (entryPoints.length > 1) {
+    canvas.addEventListener('click', () => {
+      gpu.entry = (gpu.entry + 1) % entryPoints.length;
+      console.log(`Showing ${entryPoints[gpu.entry]}`);
+    });
+  }
+
+  if (samples) {
+    addEventListener('keydown', e => {
+      if (e.key !== '+' && e.key !== '-') return;
+      gpu.samples = Math.min(Math.max(e.key === '+' ? gpu.samples * 2 : gpu.samples / 2, 1), gpu.maxSamples);
+      console.log(`${gpu.samples} samples per pixel`);
+    });
+  }
+
+  // 4. Go — an instrumented shader logs its hottest blocks once
+  let logged = false;
+  startRenderLoop(gpu, instrument ? counts => {
+    if (logged) return;
+    logged = true;
+    const where = b => (b.file ? `${b.file}:${b.line}` : b.offset === null ? '' : `0x${b.offset.toString(16)}`);
+    const hot = shader.blocks.map((b, k) => ({ block: k, count: counts[k + 1], kind: b.kind, fn: b.fn, at: where(b) }))
+      .sort((a, b) => b.count - a.count).slice(0, 20);
+    console.log(`=== Hottest blocks (max ${counts[0]} loop iterations per pixel) ===`);
+    console.table(hot);
+  } : null);
 
 } catch (e) {
   console.error(e);
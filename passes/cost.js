@@ -0,0 +1,152 @@
+// =============================================================================
+// Static cost model
+//
+// Counts what one invocation of `main` executes once per statement, with
+// outlined helpers counted at each call site: ALU operations by operator or
+// built-in, expensive built-ins, linear-memory traffic, loop nesting,
+// and branches that need the cf_exit / cf_cont flags. Register pressure is
+// estimated as the most scalar values live at one point, with a value that
+// is live across a loop kept live for the whole loop. Not a timing model —
+// a way to compare shaders and transpiler versions without a GPU.
+// =============================================================================
+
+import { forEachExpr, stmtExprs, childBodies } from '../wgsl-ir.js';
+
+// Built-ins that cost several ALU operations: the transcendentals and those
+// built on a square root. Also what the prologue pass weighs (uniform.js).
+export const EXPENSIVE_BUILTINS = new Set(['sin', 'cos', 'tan', 'asin', 'acos', 'atan', 'atan2', 'exp', 'exp2', 'log', 'log2', 'pow', 'sqrt', 'inverseSqrt', 'length', 'normalize']);
+// Calls that only reinterpret or name a value
+const FREE = /^(bitcast<|vec[234]<|vec[234]$)/;
+
+// `helpers`: outlined functions [{ name, params, body }]; `baseBytes`:
+// private memory outside the body (mem, parameters, globals). Returns
+//   { alu: { total, byKind }, transcendental: { total, byFn },
+//     mem: { loads, stores, tables }, maxLive, loops: { count, maxDepth },
+//     cfJumps, privateBytes }
+// where `transcendental` counts the calls of EXPENSIVE_BUILTINS.
+export function costReport(body, helpers, baseBytes) {
+  const byName = new Map(helpers.map(h => [h.name, h]));
+  const memo = new Map();
+  const helperCost = name => {
+    if (!byName.has(name)) return null;
+    if (!memo.has(name)) memo.set(name, measure(byName.get(name).body, helperCost));
+    return memo.get(name);
+  };
+  const r = measure(body, helperCost);
+  return {
+    alu: { total: sum(r.alu), byKind: Object.fromEntries([...r.alu].sort((a, b) => b[1] - a[1])) },
+    transcendental: { total: sum(r.trans), byFn: Object.fromEntries([...r.trans].sort((a, b) => b[1] - a[1])) },
+    mem: r.mem,
+    maxLive: r.maxLive,
+    loops: r.loops,
+    cfJumps: r.cfJumps,
+    privateBytes: baseBytes + r.varBytes,
+  };
+}
+
+const sum = m => [...m.values()].reduce((a, b) => a + b, 0);
+const add = (m, k, n = 1) => m.set(k, (m.get(k) || 0) + n);
+const components = type => +(/^vec(\d)/.exec(type)?.[1] ?? 1);
+
+function measure(body, helperCost) {
+  const alu = new Map();
+  const trans = new Map();
+  const mem = { loads: 0, stores: 0, tables: 0 };
+  const loops = { count: 0, maxDepth: 0 };
+  let cfJumps = 0;
+  let varBytes = 0;
+  const calleeLive = []; // [position, helper's maxLive]
+
+  // ---- counts, and statement positions for liveness ----
+  const occ = new Map(); // name → { lo, hi, type, isVar, decl }
+  const loopRanges = [];
+  let pos = 0;
+  const touch = (name, type, isVar) => {
+    if (!occ.has(name)) occ.set(name, { lo: pos, hi: pos, type, isVar, decl: -1 });
+    const o = occ.get(name);
+    o.hi = pos;
+    o.isVar ||= isVar;
+    return o;
+  };
+  const countExpr = e => forEachExpr(e, n => {
+    if (n.k === 'ref') touch(n.name, n.type, false);
+    else if (n.k === 'op') add(alu, n.op);
+    else if (n.k === 'un' && n.op !== '&' && n.op !== '*') add(alu, n.op === '-' ? 'neg' : n.op);
+    else if (n.k === 'mem') n.arr ? mem.tables++ : mem.loads++;
+    else if (n.k === 'call') {
+      if (EXPENSIVE_BUILTINS.has(n.fn)) add(trans, n.fn);
+      else if (helperCost(n.fn)) {
+        const h = helperCost(n.fn);
+        for (const [k, v] of h.alu) add(alu, k, v);
+        for (const [k, v] of h.trans) add(trans, k, v);
+        mem.loads += h.mem.loads; mem.stores += h.mem.stores; mem.tables += h.mem.tables;
+        cfJumps += h.cfJumps;
+        calleeLive.push([pos, h.maxLive]);
+      } else if (!FREE.test(n.fn)) add(alu, n.fn);
+    }
+  });
+
+  // `labels`: enclosing blocks, ifs and loops, innermost last (see printJump)
+  const walk = (list, labels, depth) => {
+    for (const s of list) {
+      pos++;
+      for (const e of stmtExprs(s)) countExpr(e);
+      if (s.k === 'let') touch(s.name, s.type, false);
+      if (s.k === 'var') { touch(s.name, s.type, true).decl = pos; varBytes += 4 * components(s.type); }
+      if (s.k === 'set' && !s.name.startsWith('*') && !s.name.includes('.')) touch(s.name, s.e.type, true);
+      if (s.k === 'store') mem.stores++;
+      if (s.k === 'br') cfJumps += needsFlags(labels, s.label, 0);
+      if (s.k === 'switch') for (const l of new Set([...s.targets, s.def])) cfJumps += needsFlags(labels, l, 1);
+      if (s.k === 'block' && s.counted) touch(s.counted.name, s.counted.next.type, true);
+      const isLoop = s.k === 'block' && s.kind === 'loop';
+      if (isLoop) { loops.count++; loops.maxDepth = Math.max(loops.maxDepth, depth + 1); }
+      const start = pos;
+      for (const b of childBodies(s)) walk(b, [...labels, s], depth + isLoop);
+      if (isLoop) loopRanges.push([start, pos]);
+    }
+  };
+  walk(body, [], 0);
+
+  // ---- liveness ----
+  // A value used both inside and outside a loop, or a var declared outside
+  // it that the loop assigns (it may be read next iteration), is live for
+  // the whole loop.
+  for (let changed = true; changed;) {
+    changed = false;
+    for (const o of occ.values()) {
+      for (const [lo, hi] of loopRanges) {
+        if (o.hi < lo || o.lo > hi || (o.lo <= lo && o.hi >= hi)) continue;
+        const inside = o.lo >= lo && o.hi <= hi;
+        if (inside && !(o.isVar && (o.decl < lo || o.decl > hi))) continue;
+        o.lo = Math.min(o.lo, lo);
+        o.hi = Math.max(o.hi, hi);
+        changed = true;
+      }
+    }
+  }
+  const delta = new Array(pos + 2).fill(0);
+  for (const o of occ.values()) {
+    delta[o.lo] += components(o.type);
+    delta[o.hi + 1] -= components(o.type);
+  }
+  const extra = new Array(pos + 1).fill(0);
+  for (const [p, n] of calleeLive) extra[p] = Math.max(extra[p], n);
+  let live = 0;
+  let maxLive = 0;
+  for (let p = 0; p <= pos; p++) {
+    live += delta[p];
+    maxLive = Math.max(maxLive, live + extra[p]);
+  }
+  return { alu, trans, mem, loops, cfJumps, varBytes, maxLive };
+}
+
+// Whether a branch from inside `labels` to `label` goes through the
+// cf_exit / cf_cont flags, as printBody() emits it
+function needsFlags(labels, label, extra) {
+  let i = labels.length - 1;
+  while (i >= 0 && labels[i].label !== label) i--;
+  if (i < 0) return 0;
+  const depth = labels.length - 1 - i;
+  if (depth === 0 && labels[i].kind === 'loop') return 0;
+  return depth + extra === 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+// =============================================================================
+// Data segments → read-only tables
+//
+// clang puts initialized globals (palettes, map geometry, precomputed
+// constants) in data segments that WASM copies into linear memory before
+// mainImage runs. Here `mem` is per invocation, so doing the same would cost
+// every pixel a copy of every table. Instead each segment becomes a
+// module-scope `const` array, or a slice of the read-only `rodata` storage
+// buffer when it is large, and its loads index that directly. A load reads a
+// segment when its address is `x + C` with the constant C inside the segment,
+// which is how clang addresses a global array; a load from a constant address
+// is folded to the word itself.
+//
+// That is only safe while such loads are the segment's only references. Any
+// other constant in its address range — a store, a pointer kept in a local or
+// passed to memory.copy — lets code reach it through `mem`, so that segment
+// is copied into `mem` at entry instead and its loads are left alone. So may
+// any access whose address is neither constant nor built from the stack
+// pointer: clang addresses `table[i - 1]` as `4 * i + (C - 4)`, with a
+// constant just below the segment, and so may a linked function that uses
+// mem (a `mem` call), which counts as both. After an unexplained store every segment
+// stays in `mem`; after unexplained loads every segment is also copied
+// there, and the table loads keep reading the tables.
+// =============================================================================
+
+import { lit, op, mem, forEachExpr, forEachStmt, stmtExprs, mapExpr, mapStmtExprs, callsMem } from '../wgsl-ir.js';
+import { countUses } from './propagate.js';
+
+// Segments up to this many words become `const` arrays; larger ones would
+// bloat the shader source and go to the storage buffer.
+const MAX_CONST_WORDS = 1024;
+
+// `segments`: the active data segments [{ offset, bytes }] in section order;
+// `bases`: names whose initial value points outside every segment (the stack
+// pointer, the fragColor parameter). Rewrites `body` and returns
+//   { tables: [{ name, words }],   const arrays to declare
+//     rodata,                      Uint32Array for the storage buffer, or null
+//     copies: [{ src, from, to, count }] }  words to copy into mem at entry
+export function lowerDataSegments(body, segments, bases = new Set()) {
+  const segs = segments.filter(s => s.bytes.length).map(s => ({
+    lo: s.offset, hi: s.offset + s.bytes.length,
+    w0: s.offset >>> 2, w1: (s.offset + s.bytes.length + 3) >>> 2,
+  }));
+  if (!segs.length) return { tables: [], rodata: null, copies: [] };
+  // Memory image after instantiation; a later segment overwrites an earlier one.
+  const base = Math.min(...segs.map(s => s.w0));
+  const image = new Uint8Array((Math.max(...segs.map(s => s.w1)) - base) * 4);
+  segments.forEach(s => image.set(s.bytes, s.offset - base * 4));
+  const words = new Uint32Array(image.buffer);
+  const word = w => words[w - base];
+  const segAt = addr => segs.findIndex(s => addr >= s.lo && addr < s.hi);
+  const segOfWord = w => segs.findIndex(s => w >= s.w0 && w < s.w1);
+
+  const lets = new Map();
+  forEachStmt(body, s => { if (s.k === 'let') lets.set(s.name, s); });
+  const uses = countUses(body);
+
+  // `x + C` with exactly one literal term C inside a segment
+  const addrOf = e => {
+    const terms = [];
+    const flatten = t => { if (t.k === 'op' && t.op === '+' && t.type === 'u32') { flatten(t.a); flatten(t.b); } else terms.push(t); };
+    flatten(e);
+    const hits = terms.filter(t => t.k === 'lit' && t.type === 'u32' && segAt(t.v) >= 0);
+    return hits.length === 1 ? { c: hits[0], seg: segAt(hits[0].v) } : null;
+  };
+  const byWord = idx => idx.k === 'op' && idx.op === '/' && idx.b.k === 'lit' && idx.b.v === 4 ? idx.a : null;
+  // Segment read by load `n` and how: 'word' (constant index), 'addr' (the
+  // address is computed in place) or 'let' (in a `let`, for sub-word loads).
+  const site = n => {
+    if (n.k !== 'mem' || n.arr) return null;
+    if (n.idx.k === 'lit') {
+      const seg = segOfWord(n.idx.v);
+      return seg < 0 ? null : { kind: 'word', seg };
+    }
+    const a = byWord(n.idx);
+    if (!a) return null;
+    if (a.k === 'ref' && lets.has(a.name)) {
+      const at = addrOf(lets.get(a.name).e);
+      return at && { kind: 'let', seg: at.seg, name: a.name };
+    }
+    const at = addrOf(a);
+    return at && { kind: 'addr', seg: at.seg };
+  };
+
+  // Constants in each segment's range, and those that belong to a load
+  const refs = segs.map(() => 0);
+  const loads = segs.map(() => 0);
+  const escaped = new Set();
+  const letReads = new Map(); // let name → uses as a load address or `& 3u`
+  forEachStmt(body, s => {
+    if (s.k === 'store' && s.idx.k === 'lit' && segOfWord(s.idx.v) >= 0) escaped.add(segOfWord(s.idx.v));
+    for (const e of stmtExprs(s)) {
+      forEachExpr(e, n => {
+        if (n.k === 'lit' && n.type === 'u32' && segAt(n.v) >= 0) refs[segAt(n.v)]++;
+        if (n.k === 'op' && n.op === '&' && n.a.k === 'ref' && n.b.k === 'lit' && n.b.v === 3) {
+          letReads.set(n.a.name, (letReads.get(n.a.name) || 0) + 1);
+        }
+        const r = site(n);
+        if (r?.kind === 'addr') loads[r.seg]++;
+        if (r?.kind === 'let') letReads.set(r.name, (letReads.get(r.name) || 0) + 1);
+      });
+    }
+  });
+  for (const [name, n] of letReads) {
+    const at = lets.has(name) && addrOf(lets.get(name).e);
+    if (at && n === uses.get(name)) loads[at.seg]++;
+  }
+  segs.forEach((s, i) => { if (loads[i] !== refs[i]) escaped.add(i); });
+
+  // Accesses that may reach a segment without a constant in its range
+  const local = localPointer(body, lets, bases, v => segAt(v) < 0);
+  const known = addr => addr.k === 'lit' ? segAt(addr.v) < 0 : local(addr);
+  const knownIdx = idx => (idx.k === 'lit' ? segOfWord(idx.v) < 0 : !!byWord(idx) && known(byWord(idx)));
+  const unknownLoads = () => {
+    let found = false;
+    forEachStmt(body, s => {
+      for (const e of stmtExprs(s)) {
+        forEachExpr(e, n => {
+          if (n.k === 'mem' && !n.arr && !knownIdx(n.idx)) found = true;
+          if (n.k === 'call' && n.fn === 'mem_copy' && !known(n.args[1])) found = true;
+          if (n.k === 'call' && n.mem) found = true;
+        });
+      }
+    });
+    return found;
+  };
+  let unknownStores = false;
+  forEachStmt(body, s => {
+    if (s.k === 'store' && !s.arr && !knownIdx(s.idx)) unknownStores = true;
+    if (s.k === 'expr' && s.e.k === 'call' && /^mem_(copy|fill)$/.test(s.e.fn) && !known(s.e.args[0])) unknownStores = true;
+    if (stmtExprs(s).some(callsMem)) unknownStores = true;
+  });
+  if (unknownStores) segs.forEach((s, i) => escaped.add(i));
+
+  // ---- storage ----
+
+  const tables = [];
+  const rodataWords = [];
+  const place = segs.map((s, i) => {
+    const n = s.w1 - s.w0;
+    const src = words.subarray(s.w0 - base, s.w1 - base);
+    if (n <= MAX_CONST_WORDS) {
+      tables.push({ name: `data_${i}`, words: src });
+      return { arr: `data_${i}`, at: 0 };
+    }
+    const at = rodataWords.length;
+    rodataWords.push(...src);
+    return { arr: 'rodata', at };
+  });
+  const copies = [];
+  const copy = i => {
+    const s = segs[i];
+    copies.push({ src: place[i].arr, from: place[i].at, to: s.w0, count: s.w1 - s.w0 });
+  };
+  for (const i of escaped) copy(i);
+  const used = new Set(copies.map(c => c.src));
+
+  // ---- rewrite ----
+
+  // `x + C` → `x + C'` so that the byte address is relative to the table:
+  // C' = C - 4 * (w0 - at), which keeps `& 3u` unchanged.
+  const rebase = (e, i) => {
+    const { c } = addrOf(e);
+    const delta = 4 * (segs[i].w0 - place[i].at);
+    return mapExpr(e, n => (n === c ? lit('u32', (c.v - delta) >>> 0) : undefined));
+  };
+  const rebased = [...letReads.keys()].filter(name => {
+    const at = lets.has(name) && addrOf(lets.get(name).e);
+    return at && !escaped.has(at.seg) && letReads.get(name) === uses.get(name);
+  });
+  forEachStmt(body, s => mapStmtExprs(s, e => mapExpr(e, n => {
+    const r = site(n);
+    if (!r || escaped.has(r.seg)) return;
+    if (r.kind === 'word') return lit('u32', word(n.idx.v));
+    if (r.kind === 'let' && !rebased.includes(r.name)) return;
+    used.add(place[r.seg].arr);
+    if (r.kind === 'let') return mem(n.idx, place[r.seg].arr);
+    return mem(op('/', rebase(byWord(n.idx), r.seg), lit('u32', 4), 'u32'), place[r.seg].arr);
+  })));
+  for (const name of rebased) {
+    const s = lets.get(name);
+    s.e = rebase(s.e, addrOf(s.e).seg);
+  }
+  if (escaped.size < segs.length && unknownLoads()) {
+    segs.forEach((s, i) => { if (!escaped.has(i)) copy(i); });
+    for (const c of copies) used.add(c.src);
+  }
+
+  return {
+    tables: tables.filter(t => used.has(t.name)),
+    rodata: rodataWords.length && used.has('rodata') ? Uint32Array.from(rodataWords) : null,
+    copies,
+  };
+}
+
+// Whether a byte address is built from `bases` — or from locals that only
+// ever hold such addresses, or constants for which `outside` holds — by
+// adding offsets or masking (stack frames, `alloca`s and the arrays in them).
+// Locals are assumed to qualify until an assignment says otherwise, so
+// pointers stepped in loops do too.
+function localPointer(body, lets, bases, outside) {
+  const sets = new Map();
+  forEachStmt(body, s => {
+    if (s.k !== 'set') return;
+    if (!sets.has(s.name)) sets.set(s.name, []);
+    sets.get(s.name).push(s.e);
+  });
+  const ptrs = new Set([...bases, ...sets.keys()]);
+  const from = (e, seen = new Set()) => {
+    if (e.k === 'ref') {
+      if (ptrs.has(e.name)) return true;
+      if (!lets.has(e.name) || seen.has(e.name)) return false;
+      seen.add(e.name);
+      return from(lets.get(e.name).e, seen);
+    }
+    if (e.k !== 'op' || e.type !== 'u32') return false;
+    if (e.op === '+') return from(e.a, seen) || from(e.b, seen);
+    if (e.op === '-' || (e.op === '&' && e.b.k === 'lit')) return from(e.a, seen);
+    return false;
+  };
+  for (let changed = true; changed;) {
+    changed = false;
+    for (const [name, es] of sets) {
+      if (ptrs.has(name) && !es.every(e => (e.k === 'lit' && outside(e.v)) || from(e))) { ptrs.delete(name); changed = true; }
+    }
+  }
+  return e => from(e);
+}
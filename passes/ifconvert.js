@@ -0,0 +1,179 @@
+// =============================================================================
+// If-conversion: small branch regions → select()
+//
+// clang emits short conditionals as a block that is skipped by a br_if:
+//
+//   block $b { br_if $b c; X }                         (triangle)
+//   block $a { block $b { br_if $b c; X; br $a } Y }   (diamond: Y is the tail of $a)
+//
+// When the arms only compute `let`s and assign locals, and cost no more than
+// MAX_COST operations together, the region is flattened: both arms run
+// unconditionally and every assignment keeps its old value on the path that
+// skipped it, `lN = select(new, lN, c)`. Each arm may assign a local once and
+// not read it afterwards, so assignments stay in place. A `let` that is
+// speculated this way may compute garbage, which only ever feeds the
+// discarded side of a select (WGSL has no trapping arithmetic and clamps
+// out-of-range array reads).
+//
+// With a profile (see profile.mjs) the decision also weighs how often each
+// arm ran: a region with an arm that almost never runs stays a branch, since
+// flattening would make every pixel pay for it, and one that splits the
+// pixels — the case that diverges inside a workgroup — may cost up to
+// MIXED_COST.
+// =============================================================================
+
+import { ref, lit, op, call, bitcast, forEachExpr, forEachStmt, childBodies, callsMem } from '../wgsl-ir.js';
+import { countUses, removeDeadLets } from './propagate.js';
+
+const MAX_COST = 10;
+const MIXED_COST = 20;
+// Run probability below which an arm is cold, and minority share above which
+// a branch is mixed
+const COLD = 0.05;
+const MIXED = 0.2;
+
+export function convertIfs(body, profile = null) {
+  const lets = new Map();
+  forEachStmt(body, s => { if (s.k === 'let') lets.set(s.name, s); });
+  const ctx = { lets, uses: countUses(body), profile, changed: false };
+  visit(body, null, ctx);
+  if (ctx.changed) removeDeadLets(body);
+  return body;
+}
+
+function visit(list, owner, ctx) {
+  for (const s of list) for (const b of childBodies(s)) visit(b, s, ctx);
+  for (let i = 0; i < list.length; i++) {
+    const s = list[i];
+    let flat = null;
+    if (s.k === 'if') flat = convertIf(s, ctx);
+    else if (s.k === 'block' && s.kind === 'block' && !s.counted) {
+      flat = convertTriangle(s, ctx) || (owner?.k === 'block' && owner.kind === 'block' ? convertDiamond(list, i, owner, ctx) : null);
+    }
+    if (!flat) continue;
+    list.splice(i, list.length - i, ...flat.head, ...list.slice(i + 1 + flat.tail));
+    ctx.changed = true;
+    i += flat.head.length - 1;
+  }
+  // A block that lost its last branch (the outer block of a diamond) is
+  // just its statements.
+  for (let i = 0; i < list.length; i++) {
+    const s = list[i];
+    if (s.k !== 'block' || s.kind !== 'block' || s.counted || targeted(s)) continue;
+    list.splice(i, 1, ...s.body);
+    i += s.body.length - 1;
+  }
+}
+
+function targeted(blk) {
+  let found = false;
+  forEachStmt(blk.body, s => {
+    if (s.k === 'br' && s.label === blk.label) found = true;
+    if (s.k === 'switch' && (s.def === blk.label || s.targets.includes(blk.label))) found = true;
+  });
+  return found;
+}
+
+// `block $b { lets; br_if $b c; X }`
+function convertTriangle(blk, ctx) {
+  const at = blk.body.findIndex(s => s.k !== 'let');
+  const br = blk.body[at];
+  if (at < 0 || br.k !== 'br' || br.label !== blk.label || !br.cond) return;
+  const arm = blk.body.slice(at + 1);
+  return guard(br.cond, [[arm, 'skip']], ctx, br.at) && { head: [...blk.body.slice(0, at), ...arm], tail: 0 };
+}
+
+// `block $a { ...; block $b { lets; br_if $b c; X; br $a }; Y }`
+function convertDiamond(list, i, outer, ctx) {
+  const blk = list[i];
+  const at = blk.body.findIndex(s => s.k !== 'let');
+  const br = blk.body[at];
+  const last = blk.body[blk.body.length - 1];
+  if (at < 0 || br.k !== 'br' || br.label !== blk.label || !br.cond) return;
+  if (last === br || last.k !== 'br' || last.label !== outer.label || last.cond) return;
+  const x = blk.body.slice(at + 1, -1);
+  const y = list.slice(i + 1);
+  if (!guard(br.cond, [[x, 'skip'], [y, 'take']], ctx, br.at)) return;
+  return { head: [...blk.body.slice(0, at), ...x, ...y], tail: y.length };
+}
+
+function convertIf(s, ctx) {
+  const arms = [[s.then, 'take']];
+  if (s.els) arms.push([s.els, 'skip']);
+  return guard(s.cond, arms, ctx, s.at) && { head: [...s.then, ...(s.els || [])], tail: 0 };
+}
+
+// Operation budget for flattening the branch at bytecode offset `at`, or -1
+// when an arm is cold
+function costLimit(arms, ctx, at) {
+  const b = ctx.profile?.branches[at];
+  if (!b?.total) return MAX_COST;
+  const p = b.taken / b.total;
+  if (arms.some(([, when]) => (when === 'take' ? p : 1 - p) < COLD)) return -1;
+  return Math.min(p, 1 - p) >= MIXED ? MIXED_COST : MAX_COST;
+}
+
+// Checks that the arms can be flattened and, if so, rewrites their
+// assignments in place. 'take' arms ran when `cond` held, 'skip' arms when it
+// did not; `at` is the offset of the branch instruction.
+function guard(cond, arms, ctx, at) {
+  let cost = 0;
+  let readAfterSet = false;
+  const written = new Set();
+  for (const [arm] of arms) {
+    const set = new Set();
+    for (const s of arm) {
+      if ((s.k !== 'let' && s.k !== 'set') || callsMem(s.e)) return false;
+      forEachExpr(s.e, n => {
+        if (n.k === 'ref' && set.has(n.name)) readAfterSet = true;
+        if (n.k === 'op' || n.k === 'un' || n.k === 'call' || n.k === 'mem') cost++;
+      });
+      if (s.k === 'set') {
+        if (set.has(s.name)) return false;
+        set.add(s.name);
+        cost++;
+      }
+    }
+    for (const n of set) written.add(n);
+  }
+  if (readAfterSet || cost > costLimit(arms, ctx, at) || !written.size) return false;
+
+  // The condition must mean the same thing after either arm has run.
+  const stable = e => {
+    let ok = true;
+    forEachExpr(e, n => { if (n.k === 'ref' && written.has(n.name)) ok = false; });
+    return ok;
+  };
+  let c = cond.type === 'bool' ? cond : op('!=', bitcast('u32', cond), lit('u32', 0), 'bool');
+  let flip = false;
+  // `let tN = !(x); br_if tN` — select on x with the arms swapped.
+  const def = c.k === 'ref' && ctx.uses.get(c.name) === 1 ? ctx.lets.get(c.name) : null;
+  if (def && def.e.k === 'un' && def.e.op === '!' && stable(def.e.a)) { c = def.e.a; flip = true; }
+  if (!stable(c)) return false;
+
+  // A local assigned by both arms gets a single select of the two values,
+  // provided the first one can still be read at the second assignment.
+  const first = new Map(); // name → { arm, s, value }
+  for (const [arm, when] of arms) {
+    const taken = (when === 'take') !== flip;
+    for (const s of [...arm]) {
+      if (s.k !== 'set') continue;
+      const prev = first.get(s.name);
+      if (prev && prev.arm !== arm && onlyLets(prev.value, ctx)) {
+        prev.arm.splice(prev.arm.indexOf(prev.s), 1);
+        s.e = call('select', taken ? [prev.value, s.e, c] : [s.e, prev.value, c], s.e.type);
+        continue;
+      }
+      first.set(s.name, { arm, s, value: s.e });
+      const old = ref(s.name, s.e.type);
+      s.e = call('select', taken ? [old, s.e, c] : [s.e, old, c], s.e.type);
+    }
+  }
+  return true;
+}
+
+const onlyLets = (e, ctx) => {
+  let ok = true;
+  forEachExpr(e, n => { if (n.k === 'mem' || n.mem || (n.k === 'ref' && !ctx.lets.has(n.name))) ok = false; });
+  return ok;
+};
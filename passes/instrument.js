@@ -0,0 +1,52 @@
+// =============================================================================
+// Execution counters for instrumented builds
+//
+// Counts how often each basic block runs. A block starts at function entry,
+// at the top of a loop body (the back-edge target) and of each if arm, and
+// after a statement that can jump past the rest of its list — a nested
+// block, loop or if, or a conditional br — when more statements follow.
+// Each start bumps its slot of the private array `bb`; main adds the slots
+// to the `counters` storage buffer once at the end, which costs one atomic
+// per block per invocation instead of one per execution. Loop bodies also
+// bump `steps`, the invocation's loop iteration count, which main writes to
+// the per-pixel heatmap.
+// =============================================================================
+
+import { ref, lit, op, mem } from '../wgsl-ir.js';
+
+// Instruments `body` and returns the blocks [{ kind, at }] it added, after
+// the `first` already in `bb`; kind is 'entry', 'loop', 'then', 'else' or
+// 'join', and `at` the bytecode offset of the block's first instruction.
+export function instrumentBlocks(body, first = 0) {
+  const blocks = [];
+  const counter = (kind, at) => {
+    const slot = lit('u32', first + blocks.length);
+    blocks.push({ kind, at: at ?? null });
+    return { k: 'store', arr: 'bb', idx: slot, e: op('+', mem(slot, 'bb'), lit('u32', 1), 'u32') };
+  };
+  const steps = () => ({ k: 'set', name: 'steps', e: op('+', ref('steps', 'u32'), lit('u32', 1), 'u32') });
+  // `kind`: the block that starts at the top of `list`, if any
+  const walk = (list, kind) => {
+    const out = [];
+    let start = kind;
+    let open = null; // block whose first instruction is still to come
+    for (const s of list) {
+      if (start) {
+        out.push(counter(start, s.at));
+        if (start === 'loop') out.push(steps());
+        open = blocks[blocks.length - 1];
+      }
+      // Declarations that scopeLocals() added have no offset
+      if (open && s.at !== undefined) { open.at ??= s.at; open = null; }
+      out.push(s);
+      if (s.k === 'block') walk(s.body, s.kind === 'loop' ? 'loop' : null);
+      if (s.k === 'if') { walk(s.then, 'then'); if (s.els) walk(s.els, 'else'); }
+      start = s.k === 'block' || s.k === 'if' || (s.k === 'br' && s.cond) ? 'join' : null;
+    }
+    // An empty arm still counts how often it is taken
+    if (!list.length && kind) out.push(counter(kind, null), ...(kind === 'loop' ? [steps()] : []));
+    list.splice(0, list.length, ...out);
+  };
+  walk(body, 'entry');
+  return blocks;
+}
@@ -0,0 +1,210 @@
+// =============================================================================
+// Loop optimizations: counted-loop recognition + loop-invariant code motion
+//
+// Every WASM loop is a do-while (`loop { ... br_if $self }`), which the
+// printer lowers to `loop { ...; if c { continue; } break; }`. When the back
+// edge tests an induction variable (`i = i + step; br_if (i < N)`) with a
+// known start value, the loop is re-emitted as a WGSL `for` with its bounds
+// in the header. Loops that clang rotated so that the counter test sits in
+// the middle of the body, ahead of a data-dependent back edge (chess's
+// I_MAX march loop), stay `loop {}`: a `for` would have to test before the
+// code above it or duplicate that code. Independently, pure `let`s whose
+// operands do not change inside a loop are moved in front of it, innermost
+// loops first so that a value can climb out of a whole nest.
+// =============================================================================
+
+import { ref, mapExpr, forEachExpr, forEachStmt, stmtExprs, childBodies, callsMem } from '../wgsl-ir.js';
+import { assignedIn, countUses } from './propagate.js';
+
+export function optimizeLoops(body) {
+  visit(body, countUses(body), []);
+  return body;
+}
+
+// outer: [list, index] of each enclosing statement, outermost first
+function visit(list, uses, outer) {
+  for (let i = 0; i < list.length; i++) {
+    const s = list[i];
+    for (const b of childBodies(s)) visit(b, uses, [...outer, [list, i]]);
+    i = list.indexOf(s); // a nested loop may have taken its start value from here
+    if (s.k !== 'block' || s.kind !== 'loop') continue;
+    i -= recognizeCounted(list, i, uses, outer);
+    const hoisted = hoistInvariants(s);
+    list.splice(i, 0, ...hoisted);
+    i += hoisted.length;
+  }
+}
+
+// ---- counted loops ----
+
+const CMP_OPS = new Set(['<', '<=', '>', '>=', '!=', '==']);
+
+const refersTo = (s, name) => {
+  let found = false;
+  forEachStmt([s], t => {
+    for (const e of stmtExprs(t)) forEachExpr(e, n => { if (n.k === 'ref' && n.name === name) found = true; });
+  });
+  return found;
+};
+
+const unwrap = e => (e.k === 'call' && e.fn.startsWith('bitcast<') ? e.args[0] : e);
+
+function evalCmp(o, a, b) {
+  switch (o) {
+    case '<': return a < b;
+    case '<=': return a <= b;
+    case '>': return a > b;
+    case '>=': return a >= b;
+    case '!=': return a !== b;
+    case '==': return a === b;
+  }
+}
+
+// Matches, at the end of the loop body:
+//   let tK = lN + step;  ...  lN = tK;  ...  let tC = select(0u, 1u, tK < N);  br $self tC
+// with no other way back to the header and nothing after `lN = tK` that reads
+// lN or leaves the loop, so the increment can move to the `for` update slot.
+// The back edge may end blocks that themselves end the body (clang's
+// `block { ...; br_if $self }` around early exits): leaving any of them
+// leaves the loop, so they are flattened into it and their exits retargeted
+// to a block around the `for`. Returns how many statements of `list` before
+// `at` were removed (the start value, when it was there).
+function recognizeCounted(list, at, uses, outer) {
+  const loop = list[at];
+  const exits = [];
+  let body = loop.body;
+  let back = body[body.length - 1];
+  while (back && back.k === 'block' && back.kind === 'block' && !back.counted) {
+    exits.push(back.label);
+    body = back.body;
+    back = body[body.length - 1];
+  }
+  if (!back || back.k !== 'br' || back.label !== loop.label || !back.cond) return 0;
+  let otherBack = false;
+  forEachStmt(loop.body, s => {
+    if (s.k === 'br' && s.label === loop.label && s !== back) otherBack = true;
+    if (s.k === 'switch' && (s.def === loop.label || s.targets.includes(loop.label))) otherBack = true;
+  });
+  if (otherBack) return 0;
+
+  const find = name => body.findIndex(s => s.k === 'let' && s.name === name);
+
+  // Back-edge condition: a comparison, possibly boxed into a u32 by select().
+  let cmp = back.cond;
+  let condAt = -1;
+  if (cmp.k === 'ref') {
+    condAt = find(cmp.name);
+    if (condAt < 0 || uses.get(cmp.name) !== 1) return 0;
+    cmp = body[condAt].e;
+    if (cmp.k === 'call' && cmp.fn === 'select' && cmp.args[0].v === 0 && cmp.args[1].v === 1) cmp = cmp.args[2];
+  }
+  if (cmp.k !== 'op' || !CMP_OPS.has(cmp.op)) return 0;
+  const lhs = unwrap(cmp.a);
+  const bound = unwrap(cmp.b);
+  if (lhs.k !== 'ref' || bound.k !== 'lit' || uses.get(lhs.name) !== 2) return 0;
+
+  // Induction step: `let tK = lN + step; lN = tK;`
+  const stepAt = find(lhs.name);
+  if (stepAt < 0) return 0;
+  const next = body[stepAt].e;
+  if (next.k !== 'op' || next.op !== '+' || next.a.k !== 'ref' || next.b.k !== 'lit' || next.a.type !== next.type) return 0;
+  const name = next.a.name;
+  const setAt = body.findIndex(s => s.k === 'set' && s.name === name);
+  if (setAt < stepAt || body[setAt].e.k !== 'ref' || body[setAt].e.name !== lhs.name) return 0;
+  let sets = 0;
+  forEachStmt(loop.body, s => { if (s.k === 'set' && s.name === name) sets++; });
+  if (sets !== 1) return 0;
+  for (let j = setAt + 1; j < body.length - 1; j++) {
+    const s = body[j];
+    if (j === condAt) continue;
+    if (s.k !== 'let' && s.k !== 'set' && s.k !== 'store' && s.k !== 'expr') return 0;
+    if (refersTo(s, name) || refersTo(s, lhs.name)) return 0;
+  }
+
+  // Start value: the closest preceding `lN = <literal>`, in the enclosing list
+  // or in front of the plain blocks around the loop. Everything in between
+  // must run straight through to the loop, so that moving the assignment
+  // into the `for` header changes no path that skips the loop.
+  let initList = list;
+  let initAt = -1;
+  for (let j = at - 1, depth = outer.length; ; j--) {
+    if (j < 0) {
+      const parent = depth > 0 && outer[depth - 1][0][outer[depth - 1][1]];
+      if (!parent || parent.k !== 'block' || parent.kind !== 'block' || parent.counted) break;
+      [initList, j] = outer[--depth];
+      continue;
+    }
+    const s = initList[j];
+    if (s.k === 'set' && s.name === name) { initAt = s.e.k === 'lit' ? j : -1; break; }
+    if (s.k !== 'let' && s.k !== 'set' && s.k !== 'store' && s.k !== 'expr') break;
+    if (refersTo(s, name)) break;
+  }
+  if (initAt < 0) return 0;
+
+  // A `for` tests before the first iteration; the do-while did not, so the
+  // first test must be statically true.
+  const signed = cmp.a.type === 'i32';
+  const norm = v => (signed ? v | 0 : v >>> 0);
+  const init = initList[initAt].e;
+  const start = norm(init.v);
+  const end = norm(bound.v);
+  if (!evalCmp(cmp.op, start, end)) return 0;
+  let o = cmp.op;
+  const step = norm(next.b.v);
+  if (o === '!=' && step > 0 && start < end && (end - start) % step === 0) o = '<';
+
+  const iv = ref(name, next.a.type);
+  const cond = mapExpr({ ...cmp, op: o }, n => (n.k === 'ref' && n.name === lhs.name ? iv : undefined));
+  loop.counted = { name, init, cond, next: { ...next, a: iv } };
+  const tail = body.filter((s, j) => j !== stepAt && j !== setAt && j !== condAt && s !== back);
+  if (exits.length) {
+    // The outermost of the flattened blocks now wraps the `for`
+    const flat = [];
+    for (let b = loop.body; b !== body; b = b[b.length - 1].body) flat.push(...b.slice(0, -1));
+    loop.body = [...flat, ...tail];
+    const exit = exits[0];
+    const retarget = l => (exits.includes(l) ? exit : l);
+    forEachStmt(loop.body, s => {
+      if (s.k === 'br') s.label = retarget(s.label);
+      if (s.k === 'switch') { s.targets = s.targets.map(retarget); s.def = retarget(s.def); }
+    });
+    list[at] = { k: 'block', kind: 'block', label: exit, body: [loop] };
+  } else {
+    loop.body = tail;
+  }
+  initList.splice(initAt, 1);
+  return initList === list ? 1 : 0;
+}
+
+// ---- loop-invariant code motion ----
+
+// Pure top-level `let`s of `loop` whose operands are all defined outside it
+// (or hoisted before them) and not assigned inside it. Loads qualify only
+// when the loop never writes memory, or when they read a read-only table.
+function hoistInvariants(loop) {
+  const assigned = assignedIn([loop]);
+  const inner = new Set();
+  let stores = false;
+  forEachStmt(loop.body, s => {
+    if (s.k === 'let') inner.add(s.name);
+    if (s.k === 'store' || s.k === 'expr') stores = true; // helper calls may write mem
+    if ((s.k === 'let' || s.k === 'set') && callsMem(s.e)) stores = true;
+  });
+  const invariant = e => {
+    let ok = true;
+    forEachExpr(e, n => {
+      if (n.k === 'ref' && (inner.has(n.name) || assigned.has(n.name))) ok = false;
+      if (n.k === 'mem' && !n.arr && stores) ok = false;
+      if (n.k === 'call' && n.mem) ok = false;
+    });
+    return ok;
+  };
+  const hoisted = [];
+  loop.body = loop.body.filter(s => {
+    if (s.k !== 'let' || s.e.k === 'lit' || s.e.k === 'ref' || !invariant(s.e)) return true;
+    inner.delete(s.name);
+    hoisted.push(s);
+    return false;
+  });
+  return hoisted;
+}
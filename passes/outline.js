@@ -0,0 +1,236 @@
+// =============================================================================
+// Outlining of duplicated regions
+//
+// wgsl.h helpers are always_inline, so a shader that calls the same helper
+// from several places carries one full copy per call site, and driver compile
+// time grows faster than linearly with the size of `main`. A region — a
+// block, loop or if with every branch target inside it — is hashed with its
+// own `let`s, `var`s and labels numbered in order of appearance and every
+// other name numbered as a parameter; literals only contribute their type.
+// Regions with equal keys are the same code up to renaming and constants;
+// each such group is emitted once as a WGSL `fn` and every copy becomes a
+// call, with the literals that differ between copies as extra parameters.
+// Outside names the region assigns are passed as `ptr<function, T>`, the
+// others by value. Runs last, after scopeLocals(), so that locals used only
+// inside a region are declared inside it. With a profile, regions that never
+// ran in it are outlined from MIN_COLD_SIZE: only code size is at stake
+// there.
+// =============================================================================
+
+import { ref, un, call, mapExpr, mapStmtExprs, childBodies, forEachStmt } from '../wgsl-ir.js';
+
+// Expression and statement nodes below which a call costs more than it saves
+const MIN_SIZE = 40;
+const MIN_COLD_SIZE = 10;
+// WGSL limit on function parameters
+const MAX_PARAMS = 255;
+
+// Rewrites `body` in place and returns the helpers to declare:
+// [{ name, params: [{ name, type, ptr }], body }], numbered from `first`
+export function outlineDuplicates(body, profile = null, first = 0) {
+  const cold = s => profile?.blocks[s.at] === 0;
+  const shape = shapes(body);
+  const regions = [];
+  const walk = (list, ancestors) => {
+    for (const s of list) {
+      if (s.k !== 'block' && s.k !== 'if') continue;
+      const inner = [...ancestors, s];
+      for (const b of childBodies(s)) walk(b, inner);
+      const { h, size } = shape.get(s);
+      if (size >= (cold(s) ? MIN_COLD_SIZE : MIN_SIZE)) regions.push({ s, list, ancestors, h, size });
+    }
+  };
+  walk(body, []);
+
+  // Only regions whose shape repeats can have a copy. Largest first, each
+  // size's regions are described, unless they already sit inside an
+  // outlined region, and grouped by key.
+  const repeats = new Map();
+  for (const r of regions) repeats.set(r.h, (repeats.get(r.h) || 0) + 1);
+  const bySize = new Map();
+  for (const r of regions) {
+    if (repeats.get(r.h) < 2) continue;
+    if (!bySize.has(r.size)) bySize.set(r.size, []);
+    bySize.get(r.size).push(r);
+  }
+
+  const outlined = new Set();
+  const helpers = [];
+  const inside = r => r.ancestors.some(a => outlined.has(a));
+  for (const size of [...bySize.keys()].sort((a, b) => b - a)) {
+    const groups = new Map();
+    for (const r of bySize.get(size)) {
+      if (inside(r)) continue;
+      const d = describe(r.s);
+      if (!d) continue;
+      Object.assign(r, d);
+      if (!groups.has(r.key)) groups.set(r.key, []);
+      groups.get(r.key).push(r);
+    }
+    for (const copies of groups.values()) {
+      if (copies.length < 2) continue;
+      const { free, lits } = copies[0];
+      const varying = lits.map((l, i) => copies.some(r => !Object.is(r.lits[i].v, l.v)));
+      if (free.length + varying.filter(Boolean).length > MAX_PARAMS) continue;
+      const name = `outlined_${first + helpers.length}`;
+      const params = free.map((f, j) => ({ name: `p${j}`, type: f.type, ptr: f.written }));
+      const constParam = new Map();
+      varying.forEach((v, i) => {
+        if (!v) return;
+        constParam.set(i, `p${params.length}`);
+        params.push({ name: `p${params.length}`, type: lits[i].type, ptr: false });
+      });
+      helpers.push({ name, params, body: [toHelper(copies[0].s, free, constParam)] });
+      for (const r of copies) {
+        outlined.add(r.s);
+        const args = r.free.map(f => (f.written ? un('&', ref(f.name, f.type), 'ptr') : ref(f.name, f.type)));
+        for (const i of constParam.keys()) args.push(r.lits[i]);
+        r.list[r.list.indexOf(r.s)] = { k: 'expr', e: call(name, args, 'void') };
+      }
+    }
+  }
+  return helpers;
+}
+
+// Canonical key of region `s`, its size, and its free names and literals in
+// key order. Returns null when a branch leaves the region.
+function describe(s) {
+  const local = new Map(); // names and labels defined inside → index
+  const freeAt = new Map(); // free name → slot
+  const free = [];
+  const lits = [];
+  let size = 0;
+  let escapes = false;
+  const nameKey = (name, type, written) => {
+    if (local.has(name)) return `#${local.get(name)}`;
+    if (!freeAt.has(name)) { freeAt.set(name, free.length); free.push({ name, type, written: false }); }
+    const f = free[freeAt.get(name)];
+    f.written ||= written;
+    return `$${freeAt.get(name)}:${type}`;
+  };
+  const define = name => { local.set(name, local.size); return `#${local.size - 1}`; };
+  const labelKey = label => {
+    if (!local.has(label)) escapes = true;
+    return `#${local.get(label)}`;
+  };
+  const exprKey = e => {
+    size++;
+    switch (e.k) {
+      case 'ref': return nameKey(e.name, e.type, false);
+      case 'lit': lits.push(e); return `K:${e.type}`;
+      case 'op': return `(${exprKey(e.a)}${e.op}${exprKey(e.b)}):${e.type}`;
+      case 'un': return `${e.op}(${exprKey(e.a)}):${e.type}`;
+      case 'call': return `${e.fn}(${e.args.map(exprKey).join(',')}):${e.type}`;
+      case 'mem': return `${e.arr ?? 'm'}[${exprKey(e.idx)}]`;
+      case 'lane': return `${exprKey(e.a)}.${e.lane}`;
+    }
+  };
+  const stmtKey = t => {
+    size++;
+    switch (t.k) {
+      case 'let': { const e = exprKey(t.e); return `L${define(t.name)}:${t.type}=${e}`; }
+      case 'var': return `V${define(t.name)}:${t.type}=${t.init ? exprKey(t.init) : ''}`;
+      case 'set': { const e = exprKey(t.e); return `S${nameKey(t.name, t.e.type, true)}=${e}`; }
+      case 'store': return `M${exprKey(t.idx)}=${exprKey(t.e)}`;
+      case 'expr': return `E${exprKey(t.e)}`;
+      case 'br': return `B${labelKey(t.label)}${t.cond ? `?${exprKey(t.cond)}` : ''}`;
+      case 'switch': return `W${exprKey(t.sel)}[${t.targets.map(labelKey).join(',')}|${labelKey(t.def)}]`;
+      case 'return': escapes = true; return 'R';
+      case 'if': {
+        const c = exprKey(t.cond);
+        const l = define(t.label);
+        return `I${l}?${c}{${t.then.map(stmtKey).join(';')}}{${t.els ? t.els.map(stmtKey).join(';') : ''}}`;
+      }
+      case 'block': {
+        const l = define(t.label);
+        const c = t.counted;
+        const head = c ? `F${nameKey(c.name, c.next.type, true)}=${c.init ? exprKey(c.init) : ''};${exprKey(c.cond)};${exprKey(c.next)}` : '';
+        return `${t.kind}${l}${head}{${t.body.map(stmtKey).join(';')}}`;
+      }
+    }
+  };
+  const key = stmtKey(s);
+  return escapes ? null : { key, size, free, lits };
+}
+
+// Hash of every region's describe() key with names and labels left out, and
+// its size, built bottom-up in one walk: regions with equal keys have equal
+// hashes. Region → { h, size }
+function shapes(body) {
+  const out = new Map();
+  const ids = new Map();
+  const id = tag => {
+    if (!ids.has(tag)) ids.set(tag, ids.size + 1);
+    return ids.get(tag);
+  };
+  const mix = (h, x) => Math.imul(h ^ x, 0x01000193) >>> 0;
+  let size = 0;
+  const expr = e => {
+    size++;
+    switch (e.k) {
+      case 'ref': return id('ref');
+      case 'lit': return id(`K:${e.type}`);
+      case 'op': return mix(mix(id(`${e.op}:${e.type}`), expr(e.a)), expr(e.b));
+      case 'un': return mix(id(`u${e.op}:${e.type}`), expr(e.a));
+      case 'call': return e.args.reduce((h, a) => mix(h, expr(a)), id(`${e.fn}(${e.args.length}):${e.type}`));
+      case 'mem': return mix(id(`${e.arr ?? 'm'}[]`), expr(e.idx));
+      case 'lane': return mix(id(`.${e.lane}`), expr(e.a));
+    }
+  };
+  const list = (h, l) => l.reduce((h, t) => mix(h, stmt(t)), mix(h, l.length));
+  const stmt = t => {
+    size++;
+    switch (t.k) {
+      case 'let': return mix(id(`L:${t.type}`), expr(t.e));
+      case 'var': return t.init ? mix(id(`V:${t.type}`), expr(t.init)) : id(`V:${t.type}=`);
+      case 'set': return mix(id('S'), expr(t.e));
+      case 'store': return mix(mix(id('M'), expr(t.idx)), expr(t.e));
+      case 'expr': return mix(id('E'), expr(t.e));
+      case 'br': return t.cond ? mix(id('B?'), expr(t.cond)) : id('B');
+      case 'switch': return mix(id(`W${t.targets.length}`), expr(t.sel));
+      case 'return': return id('R');
+      case 'if': {
+        const from = size - 1;
+        const h = list(list(mix(id('I'), expr(t.cond)), t.then), t.els || []);
+        out.set(t, { h, size: size - from });
+        return h;
+      }
+      case 'block': {
+        const from = size - 1;
+        const c = t.counted;
+        let h = id(`${t.kind}${c ? (c.init ? 'F=' : 'F') : ''}`);
+        if (c) h = mix(mix(c.init ? mix(h, expr(c.init)) : h, expr(c.cond)), expr(c.next));
+        h = list(h, t.body);
+        out.set(t, { h, size: size - from });
+        return h;
+      }
+    }
+  };
+  list(0, body);
+  return out;
+}
+
+// Copy of `s` with free names, and the literals at the positions in
+// `constParam`, replaced by the helper's parameters. Literals are counted in
+// the order describe() met them.
+function toHelper(s, free, constParam) {
+  const slot = new Map(free.map((f, j) => [f.name, { ...f, param: `p${j}` }]));
+  let litAt = 0;
+  const rename = e => mapExpr(e, n => {
+    if (n.k === 'lit') {
+      const p = constParam.get(litAt++);
+      return p && ref(p, n.type);
+    }
+    const f = n.k === 'ref' && slot.get(n.name);
+    if (!f) return;
+    return f.written ? un('*', ref(f.param, n.type), n.type) : ref(f.param, n.type);
+  });
+  const target = name => (slot.has(name) ? `*${slot.get(name).param}` : name);
+  const copy = structuredClone(s);
+  forEachStmt([copy], t => {
+    mapStmtExprs(t, rename);
+    if (t.k === 'set') t.name = target(t.name);
+    if (t.k === 'block' && t.counted) t.counted.name = target(t.counted.name);
+  });
+  return copy;
+}
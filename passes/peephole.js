@@ -0,0 +1,133 @@
+// =============================================================================
+// Peephole idioms
+//
+// The wgsl.h helpers (clamp, fract, mix, ...) are inlined by clang, so they
+// reach the transpiler as min/max/floor/sub/mul sequences. These rewrites put
+// the single WGSL built-in back:
+//
+//   min(max(x, lo), hi), max(min(x, hi), lo)  → clamp(x, lo, hi) / saturate(x)
+//   x - floor(x)                              → fract(x)
+//   a + t * (b - a)                           → mix(a, b, t)
+//   x / C  (C a power of two)                 → x * (1 / C)
+//   x / C, x / K  (fastMath; K an override)   → x * (1 / C), x * (1.0 / K)
+//   a * b + c                                 → fma(a, b, c)     (fuseMultiplyAdd)
+//
+// An inner `let` is only absorbed when the rewritten one is its single use,
+// and operands that move to the outer statement must be `let`s or literals so
+// they still hold the same value there. fma runs after SLP vectorization,
+// which needs the plain products to find dot(). Other reciprocals are
+// rounded, so x * (1 / C) can differ from x / C in the last bit — enough to
+// move a floor() across an integer (doom's texel lookups) — and are only
+// used with fastMath.
+// =============================================================================
+
+import { lit, call, op, forEachExpr, forEachStmt } from '../wgsl-ir.js';
+import { countUses, removeDeadLets } from './propagate.js';
+
+// `consts`: names of pipeline-overridable constants, whose reciprocal is
+// folded when the pipeline is created. `fastMath`: also divide by constants
+// whose reciprocal is inexact as a multiply.
+export function recognizeIdioms(body, consts = new Set(), fastMath = false) {
+  rewriteLets(body, idiom, consts, fastMath);
+  return body;
+}
+
+export function fuseMultiplyAdd(body) {
+  rewriteLets(body, fma);
+  return body;
+}
+
+function rewriteLets(body, rule, consts = new Set(), fastMath = false) {
+  const lets = new Map();
+  forEachStmt(body, s => { if (s.k === 'let') lets.set(s.name, s); });
+  const uses = countUses(body);
+  const ctx = {
+    consts,
+    fastMath,
+    // The `let` behind `e` when this is its only use
+    inner: e => (e.k === 'ref' && uses.get(e.name) === 1 ? lets.get(e.name) : null),
+    stable: e => {
+      let ok = true;
+      forEachExpr(e, n => { if (n.k === 'mem' || n.mem || (n.k === 'ref' && !lets.has(n.name) && !consts.has(n.name))) ok = false; });
+      return ok;
+    },
+  };
+  let changed = false;
+  forEachStmt(body, s => {
+    if (s.k !== 'let') return;
+    const r = rule(s.e, ctx);
+    if (!r) return;
+    // Keep use counts exact for the single-use tests further down.
+    forEachExpr(s.e, n => { if (n.k === 'ref') uses.set(n.name, uses.get(n.name) - 1); });
+    forEachExpr(r, n => { if (n.k === 'ref') uses.set(n.name, (uses.get(n.name) || 0) + 1); });
+    s.e = r;
+    changed = true;
+  });
+  if (changed) removeDeadLets(body, uses);
+}
+
+const isF32Lit = e => e.k === 'lit' && e.type === 'f32';
+const same = (a, b) => (a.k === 'ref' && b.k === 'ref' ? a.name === b.name : a.k === 'lit' && b.k === 'lit' && Object.is(a.v, b.v));
+const isCall = (e, fn, n) => e && e.k === 'call' && e.fn === fn && e.args.length === n;
+
+function idiom(e, ctx) {
+  if (e.type !== 'f32') return;
+
+  // clamp / saturate
+  if (isCall(e, 'min', 2) || isCall(e, 'max', 2)) {
+    const innerFn = e.fn === 'min' ? 'max' : 'min';
+    for (const [a, b] of [[e.args[0], e.args[1]], [e.args[1], e.args[0]]]) {
+      const d = ctx.inner(a);
+      if (!isF32Lit(b) || !d || !isCall(d.e, innerFn, 2)) continue;
+      const [x, c] = isF32Lit(d.e.args[1]) ? d.e.args : [d.e.args[1], d.e.args[0]];
+      if (!isF32Lit(c) || !ctx.stable(x)) continue;
+      const [lo, hi] = e.fn === 'min' ? [c, b] : [b, c];
+      if (!(lo.v <= hi.v)) continue;
+      return lo.v === 0 && hi.v === 1 ? call('saturate', [x], 'f32') : call('clamp', [x, lo, hi], 'f32');
+    }
+  }
+
+  if (e.k !== 'op') return;
+
+  // fract
+  if (e.op === '-') {
+    const d = ctx.inner(e.b);
+    if (d && isCall(d.e, 'floor', 1) && same(d.e.args[0], e.a) && ctx.stable(e.a)) return call('fract', [e.a], 'f32');
+  }
+
+  // mix: a + t * (b - a), in any operand order of + and *
+  if (e.op === '+') {
+    for (const [a, m] of [[e.a, e.b], [e.b, e.a]]) {
+      const prod = ctx.inner(m);
+      if (!prod || prod.e.k !== 'op' || prod.e.op !== '*') continue;
+      for (const [t, dv] of [[prod.e.a, prod.e.b], [prod.e.b, prod.e.a]]) {
+        const diff = ctx.inner(dv);
+        if (!diff || diff.e.k !== 'op' || diff.e.op !== '-' || !same(diff.e.b, a)) continue;
+        if (!ctx.stable(a) || !ctx.stable(t) || !ctx.stable(diff.e.a)) continue;
+        return call('mix', [a, diff.e.a, t], 'f32');
+      }
+    }
+  }
+
+  // reciprocal multiply: exact when r * C is exactly 1
+  if (e.op === '/' && isF32Lit(e.b) && e.b.v !== 0) {
+    const r = Math.fround(1 / e.b.v);
+    if (Number.isFinite(r) && r !== 0 && (ctx.fastMath || r * e.b.v === 1)) return op('*', e.a, lit('f32', r), 'f32');
+  }
+  if (e.op === '/' && e.b.k === 'ref' && ctx.consts.has(e.b.name) && ctx.fastMath) {
+    return op('*', e.a, op('/', lit('f32', 1), e.b, 'f32'), 'f32');
+  }
+}
+
+function fma(e, ctx) {
+  if (e.k !== 'op' || e.op !== '+' || !/^(f32|vec[234]<f32>)$/.test(e.type)) return;
+  for (const [m, c] of [[e.a, e.b], [e.b, e.a]]) {
+    const prod = ctx.inner(m);
+    if (!prod || prod.e.k !== 'op' || prod.e.op !== '*') continue;
+    const { a, b } = prod.e;
+    // fma() takes operands of one type: no scalar-times-vector
+    if (a.type !== e.type || b.type !== e.type || c.type !== e.type) continue;
+    if (!ctx.stable(a) || !ctx.stable(b)) continue;
+    return call('fma', [a, b, c], e.type);
+  }
+}
@@ -0,0 +1,305 @@
+// =============================================================================
+// Copy propagation + dead `let` elimination
+//
+// WASM keeps every value that outlives the stack in a local, so the raw IR is
+// full of `lN = tK; ... use(lN)`. Forwarding tK (or a literal) into the uses
+// exposes the real dataflow to later passes, and the `let`s and stores it
+// orphans are dropped.
+// =============================================================================
+
+import { lit, forEachExpr, forEachStmt, mapExpr, mapStmtExprs, stmtExprs, childBodies, callsMem } from '../wgsl-ir.js';
+
+export function propagateCopies(body) {
+  const lets = new Map(); // let name → bound expression
+  forEachStmt(body, s => { if (s.k === 'let') lets.set(s.name, s.e); });
+  forward(body, new Map(), lets, assignments(body));
+  removeDeadStores(body);
+  removeDeadLets(body);
+  return body;
+}
+
+// Drops assignments whose value no path reads: locals whose reads have all
+// been forwarded, and values overwritten before the next read (`l2 = t19;
+// l2 = t30;`). A backward liveness walk over the structured body; a branch
+// sees what is live at its target, and a loop header is iterated to a fixed
+// point. A dead assignment does not keep its operands alive, so chains of
+// copies die together. Locals do not outlive the function; a call that may
+// write mem is kept.
+function removeDeadStores(body) {
+  const vars = assignedIn(body);
+  const dead = new Set();
+  const targets = new Map(); // label → names live where a br to it lands
+  // Loop → names live at its header so far. An enclosing loop's next
+  // iteration only adds live names, so a nested loop resumes from its last
+  // fixed point instead of starting over.
+  const heads = new Map();
+  const addUses = (e, live) => forEachExpr(e, n => { if (n.k === 'ref' && vars.has(n.name)) live.add(n.name); });
+  // Names live before `list`, given those live after it; `live` is consumed.
+  const walk = (list, live) => {
+    for (let i = list.length - 1; i >= 0; i--) {
+      const s = list[i];
+      switch (s.k) {
+        case 'set':
+          if (!live.has(s.name) && !callsMem(s.e)) { dead.add(s); break; }
+          dead.delete(s);
+          live.delete(s.name);
+          addUses(s.e, live);
+          break;
+        case 'br':
+          if (!s.cond) live = new Set(targets.get(s.label));
+          else { for (const n of targets.get(s.label)) live.add(n); addUses(s.cond, live); }
+          break;
+        case 'switch':
+          live = new Set(targets.get(s.def));
+          for (const l of s.targets) for (const n of targets.get(l)) live.add(n);
+          addUses(s.sel, live);
+          break;
+        case 'return':
+          live = new Set();
+          if (s.e) addUses(s.e, live);
+          break;
+        case 'if': {
+          targets.set(s.label, live);
+          const then = walk(s.then, new Set(live));
+          live = s.els ? walk(s.els, new Set(live)) : new Set(live);
+          for (const n of then) live.add(n);
+          addUses(s.cond, live);
+          break;
+        }
+        case 'block':
+          if (s.kind === 'loop') {
+            // A counted loop tests its condition at the header, and both the
+            // end of its body and a `continue` go to its step.
+            const c = s.counted;
+            let head = heads.get(s) || new Set();
+            for (;;) {
+              let next = head;
+              if (c) {
+                next = new Set(head);
+                next.delete(c.name);
+                addUses(c.next, next);
+              }
+              targets.set(s.label, next);
+              const entry = walk(s.body, new Set(c ? next : live));
+              if (c) {
+                addUses(c.cond, entry);
+                for (const n of live) entry.add(n);
+              }
+              if (entry.size === head.size && [...entry].every(n => head.has(n))) break;
+              head = entry;
+            }
+            heads.set(s, head);
+            live = new Set(head);
+            if (c?.init) { live.delete(c.name); addUses(c.init, live); }
+          } else {
+            targets.set(s.label, live);
+            live = walk(s.body, new Set(live));
+          }
+          break;
+        default:
+          for (const e of stmtExprs(s)) addUses(e, live);
+      }
+    }
+    return live;
+  };
+  walk(body, new Set());
+  if (!dead.size) return;
+  const sweep = (list) => {
+    let j = 0;
+    for (const s of list) {
+      if (dead.has(s)) continue;
+      for (const b of childBodies(s)) sweep(b);
+      list[j++] = s;
+    }
+    list.length = j;
+  };
+  sweep(body);
+}
+
+// Names assigned anywhere inside `body` (nested statements included).
+export function assignedIn(body, out = new Set()) {
+  forEachStmt(body, s => {
+    if (s.k === 'set') out.add(s.name);
+    else if (s.k === 'block' && s.counted) out.add(s.counted.name);
+  });
+  return out;
+}
+
+// For every block and if in `body`, the names assigned inside it (nested
+// statements and a counted loop's variable included).
+export function assignments(body, out = new Map()) {
+  const walk = list => {
+    const names = new Set();
+    for (const s of list) {
+      if (s.k === 'set') names.add(s.name);
+      else if (s.k === 'block' || s.k === 'if') {
+        const inner = new Set();
+        for (const b of childBodies(s)) for (const n of walk(b)) inner.add(n);
+        if (s.counted) inner.add(s.counted.name);
+        out.set(s, inner);
+        for (const n of inner) names.add(n);
+      }
+    }
+    return names;
+  };
+  walk(body);
+  return out;
+}
+
+// For every statement, the subset of `names` that still holds its value
+// from function entry there: nothing assigns it earlier in program order or
+// anywhere in an enclosing loop (which includes the statement itself when it
+// is a loop). Statements sharing a subset share the Set.
+export function entryValues(body, names) {
+  const at = new Map();
+  const assigned = assignments(body);
+  const drop = (live, out) => ([...live].some(n => out.has(n)) ? new Set([...live].filter(n => !out.has(n))) : live);
+  const walk = (list, live) => {
+    for (const s of list) {
+      if (s.k === 'block' && s.kind === 'loop') live = drop(live, assigned.get(s));
+      at.set(s, live);
+      for (const b of childBodies(s)) walk(b, live);
+      if (s.k === 'set') live = drop(live, new Set([s.name]));
+      else if (assigned.has(s)) live = drop(live, assigned.get(s));
+    }
+  };
+  walk(body, new Set(names));
+  return at;
+}
+
+// Folds an operator whose operands are literals, with the wrapping /
+// rounding of the runtime operation. Returns undefined when the result is not
+// representable (division by zero, non-finite f32).
+function fold(n) {
+  if (n.k === 'call' && /^bitcast<[iu]32>$/.test(n.fn) && n.args[0].k === 'lit' && n.args[0].type !== 'f32') {
+    return lit(n.type, n.type === 'i32' ? n.args[0].v | 0 : n.args[0].v >>> 0);
+  }
+  if (n.k !== 'op' || n.a.k !== 'lit' || n.b.k !== 'lit' || n.a.type !== n.b.type) return;
+  const t = n.a.type;
+  const a = n.a.v, b = n.b.v;
+  if (t === 'f32') {
+    const r = { '+': a + b, '-': a - b, '*': a * b, '/': a / b }[n.op];
+    return r !== undefined && Number.isFinite(Math.fround(r)) ? lit('f32', Math.fround(r)) : undefined;
+  }
+  if (t !== 'u32' && t !== 'i32') return;
+  const norm = t === 'i32' ? v => v | 0 : v => v >>> 0;
+  let r;
+  switch (n.op) {
+    case '+': r = a + b; break;
+    case '-': r = a - b; break;
+    case '*': r = Math.imul(a, b); break;
+    case '&': r = a & b; break;
+    case '|': r = a | b; break;
+    case '^': r = a ^ b; break;
+    case '<<': r = a << (b & 31); break;
+    case '>>': r = t === 'i32' ? a >> (b & 31) : a >>> (b & 31); break;
+    case '/': case '%':
+      if (b === 0 || (t === 'i32' && a === -0x80000000 && b === -1)) return;
+      r = n.op === '/' ? Math.trunc(norm(a) / norm(b)) : norm(a) % norm(b);
+      break;
+    default: return;
+  }
+  return lit(t, norm(r));
+}
+
+// Whether `n` reads neither a name nor mem, given whether its operands do.
+function isConstant(n, known) {
+  switch (n.k) {
+    case 'op': return known(n.a) && known(n.b);
+    case 'un': case 'lane': return known(n.a);
+    case 'call': return n.args.every(known);
+  }
+  return n.k === 'lit';
+}
+
+// `env` maps a var name to the expression it currently holds — a reference
+// to an immutable `let` or a literal — valid at this point of the body.
+// `assigned` is assignments() of the whole body.
+function forward(body, env, lets, assigned) {
+  const rewrite = e => {
+    let unfolded = false;
+    let constant = null; // unfolded operations of literals only
+    const known = n => n.k === 'lit' || !!constant?.has(n);
+    const r = mapExpr(e, n => {
+      if (n.k !== 'ref') {
+        const f = fold(n);
+        if (!f && n.k !== 'lit' && isConstant(n, known)) { (constant ||= new Set()).add(n); unfolded = true; }
+        return f;
+      }
+      if (env.has(n.name)) return env.get(n.name);
+      if (lets.get(n.name)?.k === 'lit') return lets.get(n.name);
+    });
+    // Never turn a runtime operation into a const-expression: WGSL rejects
+    // those at shader creation when they overflow or divide by zero.
+    return unfolded ? e : r;
+  };
+  const without = (names) => {
+    for (const n of names) env.delete(n);
+  };
+
+  for (const s of body) {
+    // A loop header is also reached from its back edges (and a counted
+    // loop's condition and step are evaluated there).
+    const changed = assigned.get(s);
+    if (s.k === 'block' && s.kind === 'loop') without(changed);
+    mapStmtExprs(s, rewrite);
+    switch (s.k) {
+      case 'set': {
+        const v = s.e;
+        if (v.k === 'lit' || (v.k === 'ref' && lets.has(v.name))) env.set(s.name, v);
+        else env.delete(s.name);
+        break;
+      }
+      case 'block': {
+        forward(s.body, new Map(env), lets, assigned);
+        without(changed);
+        break;
+      }
+      case 'if': {
+        forward(s.then, new Map(env), lets, assigned);
+        if (s.els) forward(s.els, new Map(env), lets, assigned);
+        without(changed);
+        break;
+      }
+    }
+  }
+}
+
+// Pure `let`s without uses are dropped, together with any operand `let`s
+// that become unused as a result. `uses` (countUses() of the body, when the
+// caller keeps it current) is consumed.
+export function removeDeadLets(body, uses = countUses(body)) {
+  const dead = new Set();
+  const defs = new Map();
+  forEachStmt(body, s => { if (s.k === 'let' && !callsMem(s.e)) defs.set(s.name, s); });
+  const work = [...defs.keys()].filter(n => !uses.get(n));
+  while (work.length) {
+    const name = work.pop();
+    if (dead.has(name)) continue;
+    dead.add(name);
+    forEachExpr(defs.get(name).e, n => {
+      if (n.k !== 'ref') return;
+      const c = uses.get(n.name) - 1;
+      uses.set(n.name, c);
+      if (c === 0 && defs.has(n.name)) work.push(n.name);
+    });
+  }
+  const sweep = (list) => {
+    let j = 0;
+    for (const s of list) {
+      if (s.k === 'let' && dead.has(s.name)) continue;
+      for (const b of childBodies(s)) sweep(b);
+      list[j++] = s;
+    }
+    list.length = j;
+  };
+  sweep(body);
+  return body;
+}
+
+export function countUses(body) {
+  const uses = new Map();
+  const count = n => { if (n.k === 'ref') uses.set(n.name, (uses.get(n.name) || 0) + 1); };
+  forEachStmt(body, s => { for (const e of stmtExprs(s)) forEachExpr(e, count); });
+  return uses;
+}
@@ -0,0 +1,195 @@
+// =============================================================================
+// Local scoping + coalescing
+//
+// WASM locals are function-wide, and after inlining a shader has around a
+// hundred of them. Each one is declared in the innermost statement list that
+// contains all its uses — inside a loop body when no value is carried from
+// one iteration to the next — and locals of the same type that share a list
+// and are never live at the same time are merged into one variable. A
+// declaration only keeps its `= 0` initializer when some path can read the
+// local before writing it.
+// =============================================================================
+
+import { ref, lit, forEachExpr, stmtExprs, mapExpr, mapStmtExprs, childBodies, forEachStmt } from '../wgsl-ir.js';
+
+// `types` maps each local to place to its WGSL type; other names are left
+// alone.
+export function scopeLocals(body, types) {
+  const info = new Map(); // name → { chain, first, last, loops, at: Map(list → first index) }
+  const loops = [];       // { s, start, end }
+  const lists = [];       // statement lists enclosing the current statement
+  const indices = [];
+  const open = [];        // enclosing loops
+  let pos = 0;
+
+  const occur = name => {
+    if (!types.has(name)) return;
+    let v = info.get(name);
+    if (!v) {
+      v = { name, chain: lists.slice(), first: pos, last: pos, loops: new Set(), at: new Map() };
+      info.set(name, v);
+    }
+    let n = 0;
+    while (n < v.chain.length && n < lists.length && v.chain[n] === lists[n]) n++;
+    v.chain.length = n;
+    v.last = pos;
+    for (const l of open) v.loops.add(l);
+    for (let i = 0; i < lists.length; i++) if (!v.at.has(lists[i])) v.at.set(lists[i], indices[i]);
+  };
+  const walk = (list) => {
+    lists.push(list);
+    indices.push(0);
+    list.forEach((s, i) => {
+      indices[indices.length - 1] = i;
+      pos++;
+      // A counted loop's header belongs to the loop: it runs every iteration.
+      const loop = s.k === 'block' && s.kind === 'loop' ? { s, start: pos } : null;
+      if (loop) open.push(loop);
+      if (s.k === 'set') occur(s.name);
+      if (s.k === 'block' && s.counted) occur(s.counted.name);
+      for (const e of stmtExprs(s)) forEachExpr(e, n => { if (n.k === 'ref') occur(n.name); });
+      for (const b of childBodies(s)) walk(b);
+      if (loop) { open.pop(); loop.end = pos; loops.push(loop); }
+    });
+    lists.pop();
+    indices.pop();
+  };
+  walk(body);
+
+  // ---- choose a scope and a live interval for every local ----
+
+  // Statements before a local's first occurrence in a list cannot read it
+  const from = (v, list) => list.slice(v.at.get(list) ?? 0);
+  const groups = new Map(); // list → Map(type → [info])
+  for (const v of info.values()) {
+    let d = v.chain.length - 1;
+    while (d > 0 && exposed(from(v, v.chain[d]), v.name)) d--;
+    v.list = v.chain[d];
+    v.zero = d === 0 && exposed(from(v, body), v.name);
+    if (v.zero) v.first = 0;
+    // A local live across a back edge (or into/out of the loop) is live in
+    // the whole loop.
+    for (const l of v.loops) {
+      const escapes = v.first < l.start || v.last > l.end;
+      if (escapes || l.s.counted?.name === v.name || exposed(from(v, l.s.body), v.name)) {
+        v.first = Math.min(v.first, l.start);
+        v.last = Math.max(v.last, l.end);
+      }
+    }
+    if (!groups.has(v.list)) groups.set(v.list, new Map());
+    const byType = groups.get(v.list);
+    const t = types.get(v.name);
+    if (!byType.has(t)) byType.set(t, []);
+    byType.get(t).push(v);
+  }
+
+  // ---- coalesce, then declare ----
+
+  const rename = new Map();
+  const decls = new Map(); // list → [{ index, stmt }]
+  for (const [list, byType] of groups) {
+    for (const [type, vars] of byType) {
+      vars.sort((a, b) => a.first - b.first);
+      const regs = [];
+      for (const v of vars) {
+        const r = regs.find(r => r.last < v.first);
+        if (r) {
+          rename.set(v.name, r.name);
+          r.last = v.last;
+          r.index = Math.min(r.index, v.at.get(list));
+        } else {
+          regs.push({ name: v.name, last: v.last, index: v.at.get(list), zero: v.zero });
+        }
+      }
+      if (!decls.has(list)) decls.set(list, []);
+      for (const r of regs) {
+        decls.get(list).push({ index: r.index, stmt: { k: 'var', name: r.name, type, init: r.zero ? lit(type, 0) : null } });
+      }
+    }
+  }
+
+  if (rename.size) {
+    const to = name => rename.get(name) ?? name;
+    forEachStmt(body, s => {
+      mapStmtExprs(s, e => mapExpr(e, n => (n.k === 'ref' && rename.has(n.name) ? ref(to(n.name), n.type) : undefined)));
+      if (s.k === 'set') s.name = to(s.name);
+      if (s.k === 'block' && s.counted) s.counted.name = to(s.counted.name);
+    });
+  }
+  for (const [list, ds] of decls) {
+    ds.sort((a, b) => b.index - a.index);
+    for (const { index, stmt } of ds) list.splice(index, 0, stmt);
+  }
+  return body;
+}
+
+// ---- definite assignment ----
+
+const reads = (s, name) => {
+  let found = false;
+  for (const e of stmtExprs(s)) forEachExpr(e, n => { if (n.k === 'ref' && n.name === name) found = true; });
+  return found;
+};
+
+// Names a statement reads or assigns, nested bodies included
+const mentioned = new WeakMap();
+function mentions(s) {
+  if (!mentioned.has(s)) {
+    const names = new Set();
+    if (s.k === 'set') names.add(s.name);
+    if (s.k === 'block' && s.counted) names.add(s.counted.name);
+    for (const e of stmtExprs(s)) forEachExpr(e, n => { if (n.k === 'ref') names.add(n.name); });
+    for (const b of childBodies(s)) for (const t of b) for (const n of mentions(t)) names.add(n);
+    mentioned.set(s, names);
+  }
+  return mentioned.get(s);
+}
+
+const branches = new WeakMap();
+function mayBranch(s) {
+  if (!branches.has(s)) {
+    let b = s.k === 'br' || s.k === 'switch' || s.k === 'return';
+    for (const c of childBodies(s)) if (!b) b = c.some(mayBranch);
+    branches.set(s, b);
+  }
+  return branches.get(s);
+}
+
+// Is `name` written on every way out of `list`?
+function mustAssign(list, name) {
+  for (const s of list) {
+    if (!mentions(s).has(name)) {
+      if (mayBranch(s)) return false;
+      continue;
+    }
+    if (s.k === 'set' && s.name === name) return true;
+    if (s.k === 'block' && mustAssign(s.body, name)) return true;
+    if (s.k === 'if' && s.els && mustAssign(s.then, name) && mustAssign(s.els, name)) return true;
+    if (mayBranch(s)) return false;
+  }
+  return false;
+}
+
+// Can `name` be read on some path from the start of `list` before a write?
+function exposed(list, name, assigned = false) {
+  for (const s of list) {
+    if (!mentions(s).has(name)) continue;
+    if (!assigned && reads(s, name)) {
+      if (!(s.k === 'block' && s.counted?.name === name && s.counted.init)) return true;
+    }
+    switch (s.k) {
+      case 'set': if (s.name === name) assigned = true; break;
+      case 'block': {
+        const inHeader = s.counted?.name === name;
+        if (exposed(s.body, name, assigned || inHeader)) return true;
+        assigned ||= inHeader || mustAssign(s.body, name);
+        break;
+      }
+      case 'if':
+        if (exposed(s.then, name, assigned) || (s.els && exposed(s.els, name, assigned))) return true;
+        assigned ||= !!s.els && mustAssign(s.then, name) && mustAssign(s.els, name);
+        break;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,392 @@
+// =============================================================================
+// Superword-level parallelism — re-forms vec2/vec3/vec4 math that clang
+// scalarized out of wgsl.h.
+//
+// Works bottom-up per statement list, the way LLVM's SLP vectorizer does:
+//   * seeds are f32 add-trees of products (→ dot / length), runs of stores to
+//     adjacent mem words, and groups of isomorphic `let`s;
+//   * each seed's lanes are grown through their operands into a tree of packs
+//     (same operator in every lane), splats, constant vectors and gathers;
+//   * a tree is kept only when the packs save more scalar ops than the
+//     gathers cost. Packed `let`s that still have scalar uses are re-bound to
+//     a lane of the new vector.
+// =============================================================================
+
+import { ref, op, un, call, lane, forEachExpr, childBodies, stmtExprs } from '../wgsl-ir.js';
+import { countUses } from './propagate.js';
+
+const MAX_WIDTH = 4;
+const SEED_WINDOW = 32; // statements searched for isomorphic partners
+const MAX_DEPTH = 12;   // pack levels grown below a seed
+const MAX_PACKS = 24;   // packs tried while growing one seed's tree
+
+// Component-wise built-ins that accept vecN<f32> unchanged
+const LANEWISE_CALLS = new Set([
+  'min', 'max', 'abs', 'floor', 'ceil', 'trunc', 'round', 'fract', 'sqrt',
+  'sin', 'cos', 'tan', 'asin', 'acos', 'atan', 'atan2', 'exp', 'exp2',
+  'log', 'log2', 'pow', 'clamp', 'saturate', 'mix', 'fma', 'sign',
+]);
+
+const vecT = n => `vec${n}<f32>`;
+
+export function vectorize(body) {
+  const ctx = { uses: countUses(body), vc: 0, packOf: new Map() };
+  vectorizeList(body, ctx);
+  return body;
+}
+
+// Signature shared by isomorphic scalar expressions
+function shape(e) {
+  if (e.type !== 'f32') return null;
+  if (e.k === 'op' && '+-*/'.includes(e.op)) return `op${e.op}`;
+  if (e.k === 'un' && e.op === '-') return 'neg';
+  if (e.k === 'call' && LANEWISE_CALLS.has(e.fn) && e.args.every(a => a.type === 'f32')) return `${e.fn}/${e.args.length}`;
+  return null;
+}
+
+function operands(e) {
+  return e.k === 'call' ? e.args : e.k === 'op' ? [e.a, e.b] : [e.a];
+}
+
+function rebuild(e, args, type) {
+  if (e.k === 'op') return op(e.op, args[0], args[1], type);
+  if (e.k === 'un') return un(e.op, args[0], type);
+  return call(e.fn, args, type);
+}
+
+function sameExpr(a, b) {
+  if (a.k !== b.k || a.type !== b.type) return false;
+  switch (a.k) {
+    case 'ref': return a.name === b.name;
+    case 'lit': return Object.is(a.v, b.v);
+    case 'lane': return a.lane === b.lane && sameExpr(a.a, b.a);
+  }
+  return false;
+}
+
+// Returns what the list reads and assigns, nested bodies included, for the
+// enclosing list: { reads, sets }, without the lets it defines itself.
+function vectorizeList(L, ctx) {
+  const inner = new Map(); // statement → summary of its nested bodies
+  for (const s of L) {
+    const bodies = childBodies(s);
+    if (!bodies.length) continue;
+    const sum = { reads: new Set(), sets: new Set() };
+    for (const b of bodies) {
+      const r = vectorizeList(b, ctx);
+      for (const n of r.reads) sum.reads.add(n);
+      for (const n of r.sets) sum.sets.add(n);
+    }
+    if (s.counted) sum.sets.add(s.counted.name);
+    inner.set(s, sum);
+  }
+
+  // ---- per-list facts ----
+  const defAt = new Map();   // let name → index in L
+  const useAt = new Map();   // name → indices in L of statements reading it
+  const setAt = new Map();   // var name → indices in L of statements writing it
+  const note = (map, name, i) => {
+    const a = map.get(name);
+    if (!a) map.set(name, [i]); else if (a[a.length - 1] !== i) a.push(i);
+  };
+  for (let i = 0; i < L.length; i++) {
+    const s = L[i];
+    if (s.k === 'let') defAt.set(s.name, i);
+    else if (s.k === 'set') note(setAt, s.name, i);
+    for (const e of stmtExprs(s)) forEachExpr(e, n => { if (n.k === 'ref') note(useAt, n.name, i); });
+    const sum = inner.get(s);
+    if (sum) {
+      for (const n of sum.reads) note(useAt, n, i);
+      for (const n of sum.sets) note(setAt, n, i);
+    }
+  }
+  const summary = { reads: [...useAt.keys()].filter(n => !defAt.has(n)), sets: [...setAt.keys()] };
+  const letOf = name => {
+    const i = defAt.get(name);
+    return i === undefined ? null : L[i];
+  };
+
+  // A var read just before statement `a` holds the same value just before
+  // statement `b` when no statement in between writes it.
+  const stable = (name, a, b) => {
+    const sets = setAt.get(name);
+    if (!sets) return true;
+    const lo = Math.min(a, b), hi = Math.max(a, b);
+    return !sets.some(j => j >= lo && j < hi);
+  };
+
+  // Vars read by `e` (originally evaluated at `from`) are unchanged at `to`
+  const varsStable = (e, from, to) => {
+    let good = true;
+    forEachExpr(e, x => {
+      if (x.k === 'ref' && !defAt.has(x.name) && !ctx.packOf.has(x.name) && !stable(x.name, from, to)) good = false;
+    });
+    return good;
+  };
+
+  const claimed = new Set(); // lets consumed or pinned by a committed tree
+  const emits = [];          // { pos, seq, stmts }
+  const rewrites = new Map(); // index → replacement statement (or null)
+  let seq = 0;
+
+  // ---- tree construction ----
+  // Returns a node { kind, n, pos, ... } or null when the lanes cannot be
+  // combined. `pos` is the index after which the vector value is available.
+  // constant lanes: literals or lets binding literals
+  const litOf = e => {
+    if (e.k === 'lit') return e;
+    const d = e.k === 'ref' && letOf(e.name);
+    return d && d.e.k === 'lit' ? d.e : null;
+  };
+  const free = (d, tree) => d && !claimed.has(d.name) && !ctx.packOf.has(d.name) && !tree.members.has(d.name);
+  const sourcePos = (e, tree) => {
+    let pos = -1, ok = e.type === 'f32';
+    forEachExpr(e, x => {
+      if (x.k !== 'ref') return;
+      if (tree.members.has(x.name)) ok = false;
+      const p = ctx.packOf.get(x.name);
+      if (p) pos = Math.max(pos, p.pos);
+      else if (defAt.has(x.name)) pos = Math.max(pos, defAt.get(x.name));
+    });
+    return ok ? pos : null;
+  };
+  // an all-constant vector op would become a const-expression (see propagate.js)
+  const constant = k => k.kind === 'const' || (k.kind === 'splat' && k.e.k === 'lit');
+
+  function build(lanes, tree, depth = 0) {
+    const n = lanes.length;
+    if (lanes.every(e => e.type === 'f32' && litOf(e))) {
+      const vals = lanes.map(litOf);
+      if (vals.every(v => Object.is(v.v, vals[0].v))) return { kind: 'splat', n, pos: -1, e: vals[0] };
+      return { kind: 'const', n, pos: -1, vals };
+    }
+    // an existing vector, in lane order
+    const p0 = lanes[0].k === 'ref' && ctx.packOf.get(lanes[0].name);
+    if (p0 && p0.width === n && lanes.every((e, i) => e.k === 'ref' && ctx.packOf.get(e.name) === p0 && p0.lanes[i] === e.name)) {
+      return { kind: 'vec', n, pos: p0.pos, name: p0.name };
+    }
+    // a pack: every lane a distinct, free let with the same shape
+    const defs = lanes.map(e => (e.k === 'ref' ? letOf(e.name) : null));
+    const sh = defs[0] && shape(defs[0].e);
+    if (sh && depth < MAX_DEPTH && tree.budget-- > 0 && defs.every(d => free(d, tree) && shape(d.e) === sh) && new Set(defs.map(d => d.name)).size === n) {
+      const mark = tree.packs.length;
+      for (const d of defs) tree.members.add(d.name);
+      const kids = [];
+      for (let j = 0; j < operands(defs[0].e).length; j++) {
+        const kid = build(defs.map(d => operands(d.e)[j]), tree, depth + 1);
+        if (!kid) break;
+        kids.push(kid);
+      }
+      if (kids.length === operands(defs[0].e).length && !kids.every(constant)) {
+        const pos = Math.max(-1, ...kids.map(k => k.pos));
+        // vars read by the lanes must be unchanged where the vector is computed
+        if (defs.every(d => varsStable(d.e, defAt.get(d.name), pos + 1))) {
+          const node = { kind: 'pack', n, pos, defs, kids, tmpl: defs[0].e, name: null };
+          tree.packs.push(node);
+          return node;
+        }
+      }
+      for (const p of tree.packs.splice(mark)) for (const d of p.defs) tree.members.delete(d.name);
+      for (const d of defs) tree.members.delete(d.name);
+    }
+    // all lanes the same scalar
+    if (lanes.every(e => sameExpr(e, lanes[0]))) {
+      const pos = sourcePos(lanes[0], tree);
+      return pos === null ? null : { kind: 'splat', n, pos, e: lanes[0] };
+    }
+    // fallback: build the vector from scalars
+    let pos = -1;
+    for (const e of lanes) {
+      const p = sourcePos(e, tree);
+      if (p === null) return null;
+      pos = Math.max(pos, p);
+    }
+    return { kind: 'gather', n, pos, lanes };
+  }
+
+  function savings(node) {
+    switch (node.kind) {
+      case 'pack': return node.n - 1 + node.kids.reduce((s, k) => s + savings(k), 0);
+      case 'gather': return -1;
+      default: return 0;
+    }
+  }
+
+  function vexpr(node) {
+    const T = vecT(node.n);
+    switch (node.kind) {
+      case 'pack': case 'vec': return ref(node.name, T);
+      case 'splat': return call(T, [laneExpr(node.e)], T);
+      case 'const': return call(T, node.vals, T);
+      case 'gather': return call(T, node.lanes.map(laneExpr), T);
+    }
+  }
+
+  // Scalar uses of values that now live in a vector read the lane directly
+  function laneExpr(e) {
+    if (e.k !== 'ref') return e;
+    const p = ctx.packOf.get(e.name);
+    return p ? lane(ref(p.name, vecT(p.width)), p.lanes.indexOf(e.name), 'f32') : e;
+  }
+
+  // Scalar lets read by splats/gathers must stay scalar from now on
+  function pin(node) {
+    if (node.kind === 'pack') node.kids.forEach(pin);
+    const lanes = node.kind === 'gather' ? node.lanes : node.kind === 'splat' ? [node.e] : [];
+    for (const e of lanes) forEachExpr(e, x => { if (x.k === 'ref' && defAt.has(x.name)) claimed.add(x.name); });
+  }
+
+  // Emits the tree's vector lets. Fails when a packed let still has a scalar
+  // use (outside the statements the tree replaces) before its vector exists.
+  function commit(tree, roots, internal) {
+    for (const p of tree.packs) for (const d of p.defs) internal.add(defAt.get(d.name));
+    for (const p of tree.packs) {
+      for (const d of p.defs) {
+        if ((useAt.get(d.name) || []).some(i => !internal.has(i) && i <= p.pos)) return false;
+      }
+    }
+    roots.forEach(pin);
+    for (const p of tree.packs) p.name = `v${ctx.vc++}`;
+    for (const p of tree.packs) {
+      // infix operators take a scalar operand as-is (v * s)
+      const args = p.kids.map(k => (p.tmpl.k === 'op' && k.kind === 'splat' && p.kids.some(o => o.kind !== 'splat') ? laneExpr(k.e) : vexpr(k)));
+      const stmts = [{ k: 'let', name: p.name, type: vecT(p.n), e: rebuild(p.tmpl, args, vecT(p.n)) }];
+      const entry = { name: p.name, width: p.n, pos: p.pos, lanes: p.defs.map(d => d.name) };
+      p.defs.forEach((d, i) => {
+        ctx.packOf.set(d.name, entry);
+        claimed.add(d.name);
+        rewrites.set(defAt.get(d.name), null);
+        if ((useAt.get(d.name) || []).some(j => !internal.has(j))) {
+          stmts.push({ k: 'let', name: d.name, type: 'f32', e: lane(ref(p.name, vecT(p.n)), i, 'f32') });
+        }
+      });
+      emits.push({ pos: p.pos, seq: seq++, stmts });
+    }
+    return true;
+  }
+
+  const newTree = () => ({ members: new Set(), packs: [], budget: MAX_PACKS });
+
+  // ---- seeds: dot products (and length) ----
+  const single = name => ctx.uses.get(name) === 1 && !claimed.has(name) && letOf(name);
+  L.forEach((s, i) => {
+    if (s.k !== 'let' || s.e.k !== 'op' || s.e.op !== '+' || s.type !== 'f32' || claimed.has(s.name)) return;
+    const terms = [], inner = [];
+    const flatten = e => {
+      const d = e.k === 'ref' && single(e.name);
+      if (d && d.e.k === 'op' && d.e.op === '+' && d.type === 'f32') { inner.push(d); flatten(d.e.a); flatten(d.e.b); return; }
+      terms.push(e);
+    };
+    flatten(s.e.a); flatten(s.e.b);
+    if (terms.length < 2 || terms.length > MAX_WIDTH) return;
+    const prods = terms.map(e => (e.k === 'ref' ? single(e.name) : null));
+    if (!prods.every(d => d && d.e.k === 'op' && d.e.op === '*' && d.type === 'f32')) return;
+    const tree = newTree();
+    for (const d of [...inner, ...prods]) tree.members.add(d.name);
+    const lhs = prods.map(d => d.e.a), rhs = prods.map(d => d.e.b);
+    const a = build(lhs, tree);
+    const b = a && (lhs.every((e, k) => sameExpr(e, rhs[k])) ? a : build(rhs, tree));
+    if (!a || !b) return;
+    if (terms.length === 2 && a.kind === 'gather' && b.kind === 'gather') return;
+    // the dot is computed at the root; operands must be ready and unchanged there
+    if (Math.max(a.pos, b.pos) >= i) return;
+    if (!prods.every(d => varsStable(d.e, defAt.get(d.name), i))) return;
+    const internal = new Set([i, ...[...inner, ...prods].map(d => defAt.get(d.name))]);
+    if (!commit(tree, [a, b], internal)) return;
+    for (const d of [...inner, ...prods]) { claimed.add(d.name); rewrites.set(defAt.get(d.name), null); }
+    claimed.add(s.name);
+    // sqrt(dot(v, v)) → length(v)
+    const users = useAt.get(s.name) || [];
+    const sq = a === b && users.length === 1 && ctx.uses.get(s.name) === 1 && !rewrites.has(users[0]) ? L[users[0]] : null;
+    if (sq && sq.k === 'let' && sq.e.k === 'call' && sq.e.fn === 'sqrt' && sq.e.args[0].k === 'ref' && sq.e.args[0].name === s.name) {
+      rewrites.set(users[0], { ...sq, e: call('length', [vexpr(a)], 'f32') });
+      rewrites.set(i, null);
+      claimed.add(sq.name);
+    } else {
+      rewrites.set(i, { ...s, e: call('dot', [vexpr(a), vexpr(b)], 'f32') });
+    }
+  });
+
+  // ---- seeds: stores to adjacent mem words, then isomorphic lets ----
+  const seeds = [];
+  const stores = [];
+  L.forEach((s, i) => {
+    if (s.k !== 'store') return;
+    const v = s.e.k === 'call' && s.e.fn === 'bitcast<u32>' ? s.e.args[0] : null;
+    const m = storeSlot(s.idx);
+    if (v && v.type === 'f32' && m) stores.push({ i, base: m.base, off: m.off, v });
+  });
+  for (const st of stores) {
+    const run = [st];
+    for (const o of stores) {
+      if (o.base === st.base && o.off === run[run.length - 1].off + 4 && o.i > st.i && run.length < MAX_WIDTH) run.push(o);
+    }
+    if (run.length >= 2) seeds.push(run.map(r => r.v));
+  }
+  const byShape = new Map();
+  L.forEach((s, i) => {
+    if (s.k !== 'let') return;
+    const sh = shape(s.e);
+    if (!sh) return;
+    if (!byShape.has(sh)) byShape.set(sh, []);
+    byShape.get(sh).push(i);
+  });
+  for (const idxs of byShape.values()) {
+    for (let k = 0; k < idxs.length;) {
+      const group = [idxs[k]];
+      for (let m = k + 1; m < idxs.length && group.length < MAX_WIDTH && idxs[m] - idxs[k] <= SEED_WINDOW; m++) group.push(idxs[m]);
+      if (group.length >= 2) seeds.push(group.map(i => ref(L[i].name, 'f32')));
+      k += group.length;
+    }
+  }
+
+  // A tree of two packs or more needs an operand that is itself packable
+  const packable = lanes => {
+    const defs = lanes.map(e => (e.k === 'ref' ? letOf(e.name) : null));
+    const sh = defs[0] && shape(defs[0].e);
+    return !!sh && defs.every(d => d && !claimed.has(d.name) && !ctx.packOf.has(d.name) && shape(d.e) === sh) &&
+      new Set(defs.map(d => d.name)).size === lanes.length;
+  };
+  const tried = new Set();
+  for (const lanes of seeds) {
+    for (let n = Math.min(lanes.length, MAX_WIDTH); n >= 2; n--) {
+      const sub = lanes.slice(0, n);
+      if (sub.some(e => e.k !== 'ref' || claimed.has(e.name) || !defAt.has(e.name))) continue;
+      const key = sub.map(e => e.name).join();
+      if (tried.has(key)) continue;
+      tried.add(key);
+      if (!packable(sub)) continue;
+      const defs = sub.map(e => letOf(e.name));
+      if (!operands(defs[0].e).some((_, j) => packable(defs.map(d => operands(d.e)[j])))) continue;
+      const tree = newTree();
+      const node = build(sub, tree);
+      if (!node || node.kind !== 'pack' || tree.packs.length < 2 || savings(node) <= 0) continue;
+      if (commit(tree, [node], new Set())) break;
+    }
+  }
+
+  if (!emits.length && !rewrites.size) return summary;
+
+  // ---- rewrite the list ----
+  emits.sort((a, b) => a.pos - b.pos || a.seq - b.seq);
+  const out = [];
+  let e = 0;
+  while (e < emits.length && emits[e].pos < 0) out.push(...emits[e++].stmts);
+  L.forEach((s, i) => {
+    if (rewrites.has(i)) { const r = rewrites.get(i); if (r) out.push(r); }
+    else out.push(s);
+    while (e < emits.length && emits[e].pos === i) out.push(...emits[e++].stmts);
+  });
+  L.length = 0;
+  L.push(...out);
+  return summary;
+}
+
+// mem[(base + off) / 4u] → { base, off } with base printed for comparison
+function storeSlot(idx) {
+  if (idx.k !== 'op' || idx.op !== '/' || idx.b.k !== 'lit' || idx.b.v !== 4) return null;
+  const sum = idx.a;
+  if (sum.k !== 'op' || sum.op !== '+' || sum.b.k !== 'lit') return null;
+  if (sum.a.k !== 'ref') return null;
+  return { base: sum.a.name, off: sum.b.v };
+}
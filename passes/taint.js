@@ -0,0 +1,45 @@
+// =============================================================================
+// Taint analysis: does an input reach the output?
+//
+// The shader's only effect is linear memory (the pixel is read back from
+// mem[0..3]), so an input matters when its entry value can reach a store, a
+// memory helper call, a call to a linked function that uses mem, or a branch. Taint spreads through `let`s and locals
+// flow-insensitively; a branch on a tainted value is assumed to change
+// everything after it. Used to tell static shaders from animated ones.
+// =============================================================================
+
+import { forEachExpr, forEachStmt, stmtExprs, callsMem } from '../wgsl-ir.js';
+import { entryValues } from './propagate.js';
+
+export function reachesOutput(body, source) {
+  const entry = entryValues(body, [source]);
+  const flows = new Map(); // name → names assigned from it
+  const tainted = new Set();
+  const work = [];
+  const taint = name => { if (!tainted.has(name)) { tainted.add(name); work.push(name); } };
+  const assign = (s, name, e) => forEachExpr(e, n => {
+    if (n.k !== 'ref') return;
+    if (n.name === source && entry.get(s).has(source)) taint(name);
+    if (!flows.has(n.name)) flows.set(n.name, []);
+    flows.get(n.name).push(name);
+  });
+  forEachStmt(body, s => {
+    if (s.k === 'let' || s.k === 'set') assign(s, s.name, s.e);
+    if (s.k === 'block' && s.counted) for (const e of stmtExprs(s)) assign(s, s.counted.name, e);
+  });
+  while (work.length) for (const n of flows.get(work.pop()) || []) taint(n);
+
+  const reads = (s, e) => {
+    let t = false;
+    forEachExpr(e, n => {
+      if (n.k === 'ref' && (tainted.has(n.name) || (n.name === source && entry.get(s).has(source)))) t = true;
+    });
+    return t;
+  };
+  let reaches = false;
+  forEachStmt(body, s => {
+    if ((s.k === 'let' || s.k === 'set' || s.k === 'var') && !stmtExprs(s).some(callsMem)) return;
+    if (stmtExprs(s).some(e => reads(s, e))) reaches = true;
+  });
+  return reaches;
+}
@@ -0,0 +1,179 @@
+// =============================================================================
+// Type inference: gives values their natural WGSL type
+//
+// The decoder only knows the two WASM storage classes — every i32 becomes a
+// u32 and comparisons are boxed with select(0u, 1u, c) — so the IR is full of
+// bitcast round-trips and `x != 0u` tests. This pass retypes a `let` or a
+// local from its declared type to `bool`, `i32`, `u32` or `f32` when every
+// definition can be produced in that type and every use wants it, so the
+// boxing disappears on both sides. Candidates are guessed from their uses
+// and dropped until the assignment is consistent.
+// =============================================================================
+
+import { ref, lit, op, un, call, forEachExpr, forEachStmt, stmtExprs, mapStmtExprs } from '../wgsl-ir.js';
+
+const INT = new Set(['i32', 'u32']);
+const WRAPPING_OPS = new Set(['+', '-', '*', '&', '|', '^']);
+const LOGIC_OPS = new Set(['&', '|', '^']);
+
+const isBitcast = e => e.k === 'call' && e.fn.startsWith('bitcast<');
+const isBit = e => e.k === 'lit' && (e.v === 0 || e.v === 1) && INT.has(e.type);
+// `x == 0u`, `x != 0u`, `x == 1u`, `x != 1u`: a truth test when x is 0 or 1
+const isBitTest = e => e.k === 'op' && (e.op === '==' || e.op === '!=') && isBit(e.b);
+const negates = e => (e.op === '==') === (e.b.v === 0);
+const isBoolBox = e => e.k === 'call' && e.fn === 'select' &&
+  e.args[0].k === 'lit' && e.args[0].v === 0 && e.args[1].k === 'lit' && e.args[1].v === 1;
+
+// `fixed` names keep their declared type (parameters and globals, which the
+// shader template initializes itself). Returns the new types of retyped vars.
+export function inferTypes(body, fixed = new Set()) {
+  const declared = new Map();   // name → declared type
+  const defs = new Map();       // name → [defining expressions]
+  const addDef = (name, e) => { if (!defs.has(name)) defs.set(name, []); defs.get(name).push(e); };
+  forEachStmt(body, s => {
+    if (s.k === 'let') { declared.set(s.name, s.type); addDef(s.name, s.e); }
+    if (s.k === 'set') addDef(s.name, s.e);
+    for (const e of stmtExprs(s)) forEachExpr(e, n => { if (n.k === 'ref' && !declared.has(n.name)) declared.set(n.name, n.type); });
+  });
+
+  // Initial guess: what each name's uses ask for.
+  const want = new Map();
+  const wish = (name, t) => {
+    if (!defs.has(name) || fixed.has(name) || t === declared.get(name)) return;
+    const w = want.get(name);
+    want.set(name, w === undefined || w === t ? t : null);
+  };
+  const guess = e => forEachExpr(e, n => {
+    if (isBitcast(n) && n.args[0].k === 'ref') wish(n.args[0].name, n.type);
+    if (isBitTest(n) && n.a.k === 'ref') wish(n.a.name, 'bool');
+  });
+  forEachStmt(body, s => {
+    for (const e of stmtExprs(s)) guess(e);
+    if ((s.k === 'br' || s.k === 'if') && s.cond?.k === 'ref') wish(s.cond.name, 'bool');
+  });
+  // Operands that a candidate's definitions would compute in its new type.
+  const spread = (e, t) => {
+    if (e.k === 'ref') wish(e.name, t);
+    else if (isBitcast(e)) spread(e.args[0], t);
+    else if (e.k === 'op' && INT.has(e.type) && (t === 'bool' ? LOGIC_OPS : WRAPPING_OPS).has(e.op)) { spread(e.a, t); spread(e.b, t); }
+    else if (e.k === 'call' && e.fn === 'select' && !isBoolBox(e)) { spread(e.args[0], t); spread(e.args[1], t); }
+  };
+  for (let n = -1; n !== want.size;) {
+    n = want.size;
+    for (const [name, t] of [...want]) if (t) for (const e of defs.get(name)) spread(e, t);
+  }
+  const cand = new Map([...want].filter(([, t]) => t));
+
+  // Can `e` be produced as a `t` without adding a conversion?
+  const conv = (e, t) => {
+    switch (e.k) {
+      case 'ref': return cand.has(e.name) ? cand.get(e.name) === t : e.type === t;
+      case 'lit': return t === 'bool' ? INT.has(e.type) && (e.v === 0 || e.v === 1) : e.type === t || (INT.has(t) && INT.has(e.type));
+      case 'call':
+        if (isBitcast(e)) return conv(e.args[0], t);
+        if (t === 'bool' && isBoolBox(e)) return true;
+        if (e.fn === 'select' && e.type !== 'bool') return conv(e.args[0], t) && conv(e.args[1], t);
+        return e.type === t;
+      case 'op':
+        if (t === 'bool' && INT.has(e.type) && LOGIC_OPS.has(e.op)) return conv(e.a, t) && conv(e.b, t);
+        if (INT.has(t) && INT.has(e.type) && WRAPPING_OPS.has(e.op)) return conv(e.a, t) && conv(e.b, t);
+        return e.type === t;
+    }
+    return e.type === t;
+  };
+
+  // Walks `e` evaluated as a `t` (or at its own type when t is null) and
+  // reports candidates referenced where their new type would not fit.
+  const check = (e, t, bad) => {
+    if (t && t !== e.type && conv(e, t)) {
+      switch (e.k) {
+        case 'call':
+          if (isBitcast(e)) return check(e.args[0], t, bad);
+          if (isBoolBox(e)) return check(e.args[2], null, bad);
+          check(e.args[0], t, bad); check(e.args[1], t, bad); check(e.args[2], null, bad);
+          return;
+        case 'op': check(e.a, t, bad); check(e.b, t, bad); return;
+      }
+      return;
+    }
+    if (e.k === 'ref' && cand.has(e.name) && cand.get(e.name) !== (t || e.type)) bad.add(e.name);
+    switch (e.k) {
+      case 'op': check(e.a, isBitTest(e) ? 'bool' : null, bad); check(e.b, null, bad); break;
+      case 'un': case 'lane': check(e.a, null, bad); break;
+      case 'mem': check(e.idx, null, bad); break;
+      case 'call':
+        if (isBitcast(e)) check(e.args[0], e.type, bad);
+        else for (const a of e.args) check(a, null, bad);
+        break;
+    }
+  };
+  const contexts = s => {
+    switch (s.k) {
+      case 'let': case 'set': return [[s.e, cand.get(s.name) || null]];
+      case 'br': case 'if': return s.cond ? [[s.cond, 'bool']] : [];
+    }
+    return stmtExprs(s).map(e => [e, null]);
+  };
+
+  for (;;) {
+    const bad = new Set();
+    for (const [name, t] of cand) if (!defs.get(name).every(e => conv(e, t))) bad.add(name);
+    forEachStmt(body, s => { for (const [e, t] of contexts(s)) check(e, t, bad); });
+    if (!bad.size) break;
+    for (const name of bad) cand.delete(name);
+  }
+
+  // ---- rewrite ----
+
+  const retype = (e, t) => {
+    if (t && t !== e.type && conv(e, t)) {
+      switch (e.k) {
+        case 'ref': return ref(e.name, t);
+        case 'lit': return t === 'bool' ? lit('bool', e.v === 1) : lit(t, e.v);
+        case 'call':
+          if (isBitcast(e)) return retype(e.args[0], t);
+          if (isBoolBox(e)) return retype(e.args[2], null);
+          return call('select', [retype(e.args[0], t), retype(e.args[1], t), retype(e.args[2], null)], t);
+        case 'op':
+          if (t === 'bool' && e.op === '^' && e.b.k === 'lit') return e.b.v ? un('!', retype(e.a, t), t) : retype(e.a, t);
+          // WGSL has no `^` on bool; inequality is the same truth table.
+          return op(t === 'bool' && e.op === '^' ? '!=' : e.op, retype(e.a, t), retype(e.b, t), t);
+      }
+    }
+    switch (e.k) {
+      case 'ref': return cand.has(e.name) ? ref(e.name, cand.get(e.name)) : e;
+      case 'op': {
+        if (isBitTest(e) && conv(e.a, 'bool')) {
+          const a = retype(e.a, 'bool');
+          return negates(e) ? un('!', a, 'bool') : a;
+        }
+        return { ...e, a: retype(e.a, null), b: retype(e.b, null) };
+      }
+      case 'un': case 'lane': return { ...e, a: retype(e.a, null) };
+      case 'mem': return { ...e, idx: retype(e.idx, null) };
+      case 'call':
+        if (isBitcast(e)) {
+          const a = retype(e.args[0], conv(e.args[0], e.type) ? e.type : null);
+          return a.type === e.type ? a : { ...e, args: [a] };
+        }
+        return { ...e, args: e.args.map(a => retype(a, null)) };
+    }
+    return e;
+  };
+
+  const varTypes = new Map();
+  forEachStmt(body, s => {
+    if (s.k === 'let' && cand.has(s.name)) {
+      s.type = cand.get(s.name);
+      s.e = retype(s.e, s.type);
+    } else if (s.k === 'set' && cand.has(s.name)) {
+      varTypes.set(s.name, cand.get(s.name));
+      s.e = retype(s.e, cand.get(s.name));
+    } else if (s.k === 'br' || s.k === 'if') {
+      if (s.cond) s.cond = conv(s.cond, 'bool') ? retype(s.cond, 'bool') : retype(s.cond, null);
+    } else {
+      mapStmtExprs(s, e => retype(e, null));
+    }
+  });
+  return varTypes;
+}
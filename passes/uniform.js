@@ -0,0 +1,128 @@
+// =============================================================================
+// Uniformity: per-frame prologue extraction
+//
+// mainImage runs once per pixel, but much of it — camera setup, animation
+// curves of iTime — depends only on the uniforms. A `let` is uniform when
+// its operands are uniform `let`s, literals, read-only tables, or inputs
+// (iResolution, iTime, globals) read before anything can have reassigned
+// them, since clang reuses the parameter locals as scratch, and it calls no
+// function that uses mem. Uniform values
+// that the per-pixel code reads, and whose computation is worth more than a
+// buffer load, are computed once per frame by a one-invocation prologue and
+// stored in a `Frame` struct; in the main pass their `let`s read that struct.
+// =============================================================================
+
+import { ref, lit, op, call, forEachExpr, forEachStmt, stmtExprs, mapExpr, mapStmtExprs } from '../wgsl-ir.js';
+import { entryValues, removeDeadLets } from './propagate.js';
+import { EXPENSIVE_BUILTINS } from './cost.js';
+
+// A load from `frame`, in operations: a uniform value is exported only when
+// computing it costs more
+const LOAD_COST = 2;
+
+// `inputs`: name → type of the per-frame inputs; `consts`: module-scope
+// constants (pipeline overrides), which are uniform and which the driver
+// folds, so values computed from them alone stay where they are; `prefix`:
+// prepended to field names, which keeps the fields of several entry points
+// apart in one Frame struct. Rewrites `body` and returns the prologue, or
+// null when nothing is worth moving:
+//   { body, fields: [{ name, type }], inputs: [names the prologue reads] }
+// Bool values are stored as u32: bool is not host-shareable.
+export function extractPrologue(body, inputs, consts = new Set(), prefix = '') {
+  const uniform = new Set(consts);
+  const constant = new Set(consts);
+  const lets = [];
+  const defs = new Map();
+  const entry = entryValues(body, inputs.keys());
+  forEachStmt(body, s => {
+    if (s.k !== 'let') return;
+    lets.push(s);
+    defs.set(s.name, s);
+    let ok = true;
+    let folds = true;
+    forEachExpr(s.e, n => {
+      if ((n.k === 'mem' && !n.arr) || n.mem || (n.k === 'ref' && !uniform.has(n.name) && !entry.get(s).has(n.name))) ok = false;
+      if (n.k === 'mem' || n.mem || (n.k === 'ref' && !constant.has(n.name))) folds = false;
+    });
+    if (ok) uniform.add(s.name);
+    if (folds) constant.add(s.name);
+  });
+
+  // Uniform lets read by per-pixel code
+  const needed = new Set();
+  forEachStmt(body, s => {
+    if (s.k === 'let' && uniform.has(s.name)) return;
+    for (const e of stmtExprs(s)) {
+      forEachExpr(e, n => { if (n.k === 'ref' && defs.has(n.name) && uniform.has(n.name) && !constant.has(n.name)) needed.add(n.name); });
+    }
+  });
+
+  // Operations behind `name`, its operand lets included, counted up to
+  // `limit`. A vector built from literals and uniform lets is free: the
+  // driver assembles it from registers that are computed anyway.
+  const cost = (name, limit) => {
+    let c = 0;
+    const seen = new Set();
+    const visit = n => {
+      if (c >= limit || seen.has(n) || !defs.has(n)) return;
+      seen.add(n);
+      const e = defs.get(n).e;
+      if (!constant.has(n)) {
+        forEachExpr(e, x => {
+          if (x.k === 'call' && EXPENSIVE_BUILTINS.has(x.fn)) c += 4;
+          else if (x.k === 'call' && /^vec[234]/.test(x.fn) && x.args.every(a => a.k === 'lit' || a.k === 'ref')) return;
+          else if (x.k === 'op' || x.k === 'un' || x.k === 'call') c++;
+        });
+      }
+      forEachExpr(e, x => { if (x.k === 'ref') visit(x.name); });
+    };
+    visit(name);
+    return c;
+  };
+
+  const exported = new Set();
+  const computed = new Set(); // exported lets and the lets they read
+  const compute = n => {
+    if (computed.has(n) || !defs.has(n)) return;
+    computed.add(n);
+    forEachExpr(defs.get(n).e, e => { if (e.k === 'ref') compute(e.name); });
+  };
+  for (const name of needed) {
+    if (cost(name, LOAD_COST + 1) <= LOAD_COST) continue;
+    exported.add(name);
+    compute(name);
+  }
+  if (!exported.size) return null;
+
+  // ---- prologue ----
+
+  const pro = lets.filter(s => computed.has(s.name)).map(s => ({ ...s }));
+  const fields = [];
+  for (const s of lets.filter(s => exported.has(s.name))) {
+    const v = ref(s.name, s.type);
+    const isBool = s.type === 'bool';
+    const name = prefix + s.name;
+    fields.push({ name, type: isBool ? 'u32' : s.type });
+    pro.push({ k: 'set', name: `frame.${name}`, e: isBool ? call('select', [lit('u32', 0), lit('u32', 1), v], 'u32') : v });
+    // The main pass reads it back instead.
+    const field = ref(`frame.${name}`, isBool ? 'u32' : s.type);
+    s.e = isBool ? op('!=', field, lit('u32', 0), 'bool') : field;
+    delete s.note;
+  }
+  const used = new Set();
+  for (const s of pro) forEachExpr(s.e, n => { if (n.k === 'ref' && inputs.has(n.name)) used.add(n.name); });
+  removeDeadLets(body);
+  return { body: pro, fields, inputs: [...inputs.keys()].filter(n => used.has(n)) };
+}
+
+// Replaces reads of each input in `names` (input → module-scope name) that
+// still see its entry value, e.g. iResolution by a pipeline override.
+export function bindInputs(body, names) {
+  const entry = entryValues(body, names.keys());
+  forEachStmt(body, s => {
+    const live = entry.get(s);
+    if (!live.size) return;
+    mapStmtExprs(s, e => mapExpr(e, n => (n.k === 'ref' && live.has(n.name) ? ref(names.get(n.name), n.type) : undefined)));
+  });
+  return body;
+}
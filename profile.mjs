@@ -0,0 +1,169 @@
+#!/usr/bin/env node
+// =============================================================================
+// CPU profiling run for profile-guided transpilation
+//
+//   node profile.mjs examples/chess.wasm [--size 64x36] [--times 0,1.7,13.25] [--function mainImage] [-o out.json]
+//
+// Runs mainImage (or the image function named by --function) natively in
+// Node over a grid of pixels at a few times, with a counter on every branch
+// and loop of its body, and writes a profile
+// (default: <module>.profile.json next to the .wasm) that
+// generateComputeShader({ profile }) reads. Counters are exported mutable
+// globals added to a copy of the module, so no function index moves; math
+// imports are served by Math.
+//
+// Profile, keyed by body-relative bytecode offset (the IR's `at`) of the
+// block / loop / if / br_if instruction:
+//   { version, function, bodySize, checksum, samples,
+//     blocks:   { at: times entered },
+//     branches: { at: { taken, total } },      if: then arm taken
+//     loops:    { at: { entries, iterations } } }
+// =============================================================================
+
+import { readFileSync, writeFileSync } from 'fs';
+import { WasmParser, fnv1a } from './wasm-parser.js';
+
+const args = process.argv.slice(2);
+const opt = (name, def) => { const i = args.indexOf(name); return i < 0 ? def : args.splice(i, 2)[1]; };
+const [W, H] = opt('--size', '64x36').split('x').map(Number);
+const times = opt('--times', '0,1.7,13.25').split(',').map(Number);
+const fn = opt('--function', 'mainImage');
+const outOpt = opt('-o', null);
+const file = args[0];
+const out = outOpt ?? file?.replace(/\.wasm$/, '.profile.json');
+if (!file) {
+  console.error('usage: node profile.mjs shader.wasm [--size WxH] [--times t0,t1,...] [--function name] [-o profile.json]');
+  process.exit(1);
+}
+
+const bytes = new Uint8Array(readFileSync(file));
+const parser = new WasmParser(bytes.buffer.slice(bytes.byteOffset, bytes.byteOffset + bytes.byteLength));
+const wasm = parser.parse({ roots: [fn] });
+const main = wasm.exports.find(e => e.name === fn && e.kind === 0);
+if (!main) throw new Error(`No ${fn} export found`);
+const numImportedFuncs = wasm.imports.filter(i => i.kind === 0).length;
+const entry = wasm.codes[main.index - numImportedFuncs];
+const bodySize = entry.end - entry.bodyStart;
+
+// ---- counters ----
+
+const counters = []; // [{ at, what }], what: enter | taken | total | fall | iter
+const globalBase = wasm.imports.filter(i => i.kind === 3).length + wasm.globals.length;
+const uleb = n => { const o = []; do { let b = n & 0x7f; n >>>= 7; if (n) b |= 0x80; o.push(b); } while (n); return o; };
+// global.get g; i32.const 1; i32.add; global.set g
+const bump = (at, what) => {
+  const g = uleb(globalBase + counters.push({ at, what }) - 1);
+  return [0x23, ...g, 0x41, 1, 0x6a, 0x24, ...g];
+};
+
+const code = [...bump(-1, 'enter')];
+for (const ins of parser.instructions(entry)) {
+  if (ins.op === null) throw new Error(`unknown opcode at offset ${ins.at}`);
+  const at = ins.at - entry.bodyStart;
+  const own = bytes.subarray(ins.at, ins.end);
+  if (ins.op === 0x04) code.push(...bump(at, 'total'), ...own, ...bump(at, 'taken'));
+  else if (ins.op === 0x0d) code.push(...bump(at, 'total'), ...own, ...bump(at, 'fall'));
+  else if (ins.op === 0x03) code.push(...bump(at, 'enter'), ...own, ...bump(at, 'iter'));
+  else if (ins.op === 0x02) code.push(...own, ...bump(at, 'enter'));
+  else code.push(...own);
+}
+
+// ---- instrumented copy of the module ----
+
+const section = (id, payload) => [id, ...uleb(payload.length), ...payload];
+const newGlobals = counters.flatMap(() => [0x7f, 1, 0x41, 0, 0x0b]); // mut i32 = 0
+const newExports = counters.flatMap((_, k) => {
+  const name = [...new TextEncoder().encode(`__prof${k}`)];
+  return [...uleb(name.length), ...name, 3, ...uleb(globalBase + k)];
+});
+// LEB128 at buf[p] → [value, position after it]
+const readUleb = (buf, p) => {
+  let v = 0;
+  for (let shift = 0; ; shift += 7) {
+    const b = buf[p++];
+    v |= (b & 0x7f) << shift;
+    if (!(b & 0x80)) return [v >>> 0, p];
+  }
+};
+const sections = [];
+for (let pos = 8; pos < bytes.length;) {
+  const [size, p] = readUleb(bytes, pos + 1);
+  sections.push({ id: bytes[pos], payload: bytes.subarray(p, p + size) });
+  pos = p + size;
+}
+// Vector sections: count, then the items
+const extend = (payload, n, items) => {
+  const [count, p] = readUleb(payload, 0);
+  return [...uleb(count + n), ...payload.subarray(p), ...items];
+};
+const rebuilt = [];
+let haveGlobals = false;
+for (const s of sections) {
+  if (s.id === 7 && !haveGlobals) rebuilt.push(...section(6, [...uleb(counters.length), ...newGlobals]));
+  if (s.id === 6) { haveGlobals = true; rebuilt.push(...section(6, extend(s.payload, counters.length, newGlobals))); continue; }
+  if (s.id === 7) { haveGlobals = true; rebuilt.push(...section(7, extend(s.payload, counters.length, newExports))); continue; }
+  if (s.id === 10) {
+    const bodies = wasm.codes.map(c => {
+      if (c !== entry) return [...uleb(c.end - c.start), ...bytes.subarray(c.start, c.end)];
+      const body = [...bytes.subarray(c.start, c.bodyStart), ...code];
+      return [...uleb(body.length), ...body];
+    });
+    rebuilt.push(...section(10, [...uleb(bodies.length), ...bodies.flat()]));
+    continue;
+  }
+  rebuilt.push(...section(s.id, s.payload));
+}
+const module = new WebAssembly.Module(new Uint8Array([...bytes.subarray(0, 8), ...rebuilt]));
+
+// ---- run ----
+
+// Math library imports by name (sinf → Math.sin, fmaxf → Math.max, ...)
+const MATH = { fmaxf: Math.max, fminf: Math.min, fabsf: Math.abs, fmodf: (a, b) => a % b };
+const imports = {};
+for (const im of WebAssembly.Module.imports(module)) {
+  imports[im.module] ??= {};
+  if (im.kind === 'function') {
+    const fn = MATH[im.name] ?? Math[im.name.replace(/f$/, '')];
+    if (!fn) throw new Error(`no implementation for import ${im.name}`);
+    imports[im.module][im.name] = (...a) => Math.fround(fn(...a));
+  } else if (im.kind === 'memory') {
+    imports[im.module][im.name] = new WebAssembly.Memory({ initial: 16 });
+  }
+}
+const instance = new WebAssembly.Instance(module, imports);
+// Output pointer 0, as in the generated shader
+for (const t of times) {
+  for (let y = 0; y < H; y++) {
+    for (let x = 0; x < W; x++) instance.exports[fn](0, x + 0.5, H - y - 0.5, W, H, t);
+  }
+}
+
+// ---- profile ----
+
+const value = k => instance.exports[`__prof${k}`].value >>> 0;
+const profile = {
+  version: 1,
+  function: fn,
+  bodySize,
+  checksum: fnv1a(bytes.subarray(entry.bodyStart, entry.end)),
+  samples: 0,
+  blocks: {},
+  branches: {},
+  loops: {},
+};
+counters.forEach(({ at, what }, k) => {
+  const n = value(k);
+  if (at < 0) { profile.samples = n; return; }
+  const op = bytes[entry.bodyStart + at];
+  if (what === 'enter' || (what === 'total' && op === 0x04)) profile.blocks[at] = n;
+  if (what === 'total') (profile.branches[at] ??= { taken: 0, total: 0 }).total = n;
+  if (what === 'taken') (profile.branches[at] ??= { taken: 0, total: 0 }).taken = n;
+  if (what === 'fall') profile.branches[at].taken = profile.branches[at].total - n;
+  if (what === 'enter' && op === 0x03) (profile.loops[at] ??= {}).entries = n;
+  if (what === 'iter') profile.loops[at].iterations = n;
+});
+writeFileSync(out, JSON.stringify(profile, null, 1) + '\n');
+
+const loops = Object.values(profile.loops);
+console.log(`${file}: ${profile.samples} samples, ${Object.keys(profile.branches).length} branches, ` +
+  `${loops.length} loops (${loops.reduce((a, l) => a + l.iterations, 0)} iterations) → ${out}`);
@@ -2,7 +2,7 @@ struct Uniforms {
   time: f32,
   width: f32,
   height: f32,
-  pad: u32,
+  samples: u32,
 }
 
 @group(0) @binding(0) var<storage, read> pixels: array<f32>;
@@ -25,11 +25,18 @@ fn vs(@builtin(vertex_index) i: u32) -> VOut {
   return o;
 }
 
+// A supersampled shader writes one W x H plane per sample: their average
 @fragment
 fn fs(@location(0) uv: vec2<f32>) -> @location(0) vec4<f32> {
   let x = u32(uv.x * uniforms.width);
   let y = u32((1.0 - uv.y) * uniforms.height);
   let W = u32(uniforms.width);
-  let idx = (y * W + x) * 4u;
-  return vec4(pixels[idx], pixels[idx + 1u], pixels[idx + 2u], 1.0);
+  let plane = W * u32(uniforms.height) * 4u;
+  let n = max(uniforms.samples, 1u);
+  var col = vec3(0.0);
+  for (var s = 0u; s < n; s++) {
+    let idx = s * plane + (y * W + x) * 4u;
+    col += vec3(pixels[idx], pixels[idx + 1u], pixels[idx + 2u]);
+  }
+  return vec4(col / f32(n), 1.0);
 }
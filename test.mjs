@@ -0,0 +1,335 @@
+#!/usr/bin/env node
+// =============================================================================
+// Regression tests for the transpiler passes
+//
+//   node test.mjs
+//
+// Each test builds a small piece of IR or WASM by hand, so no toolchain is
+// needed; the examples are covered by rendering them in the demo.
+// =============================================================================
+
+import { test } from 'node:test';
+import assert from 'node:assert/strict';
+import { formatLit, printExpr, printBody, lit, op, ref, mem, call, lane } from './wgsl-ir.js';
+import { propagateCopies } from './passes/propagate.js';
+import { lowerDataSegments } from './passes/data.js';
+import { extractPrologue } from './passes/uniform.js';
+import { vectorize } from './passes/slp.js';
+import { recognizeIdioms, fuseMultiplyAdd } from './passes/peephole.js';
+import { outlineDuplicates } from './passes/outline.js';
+import { reachesOutput } from './passes/taint.js';
+import { WasmParser } from './wasm-parser.js';
+import { generateComputeShader } from './transpiler.js';
+import { minifyWGSL } from './wgsl-minify.js';
+
+// ---- hand-built WASM ----
+
+const uleb = n => { const o = []; do { o.push((n & 0x7f) | (n > 0x7f ? 0x80 : 0)); n >>>= 7; } while (n); return o; };
+const section = (id, bytes) => [id, ...uleb(bytes.length), ...bytes];
+const name = s => [...uleb(s.length), ...Buffer.from(s)];
+
+const funcBody = (code, locals) => {
+  const body = [...uleb(locals.length), ...locals.flatMap(([n, t]) => [...uleb(n), t]), ...code, 0x0b];
+  return [...uleb(body.length), ...body];
+};
+
+// A module exporting mainImage(fragColor: i32, fragCoord.xy, iResolution.xy,
+// iTime: f32) with `code` as its body, without the final `end`. `callees`
+// ({ params, results, code }) are functions 1, 2, ... of the module, and
+// global 0 is a stack pointer at 65536.
+function imageModule(code, locals = [], callees = []) {
+  const types = [[[0x7f, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d], []], ...callees.map(f => [f.params, f.results])];
+  return new Uint8Array([
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    ...section(1, [...uleb(types.length), ...types.flatMap(([p, r]) => [0x60, p.length, ...p, r.length, ...r])]),
+    ...section(3, [...uleb(types.length), ...types.map((_, i) => i)]),
+    ...section(5, [1, 0, 1]),
+    ...section(6, [1, 0x7f, 1, 0x41, 0x80, 0x80, 0x04, 0x0b]),
+    ...section(7, [2, ...name('mainImage'), 0, 0, ...name('memory'), 2, 0]),
+    ...section(10, [...uleb(types.length), ...funcBody(code, locals), ...callees.flatMap(f => funcBody(f.code, []))]),
+  ]);
+}
+
+// The printed body of main, between the parameter setup and the output write
+function mainBody(bytes, options) {
+  const { code } = generateComputeShader(new WasmParser(bytes.buffer).parse({ roots: ['mainImage'] }), options);
+  const lines = code.split('\n').map(l => l.trim());
+  return lines.slice(lines.indexOf('// --- transpiled WASM bytecode (native WGSL, no interpreter) ---') + 1, lines.indexOf('// Write output from mem[0..3]') - 1);
+}
+
+test('i32 literals print within WGSL range', () => {
+  assert.equal(formatLit('i32', -5), '-5i');
+  // A u32 0x80000000 retyped to i32: `-2147483648i` would be rejected
+  assert.equal(formatLit('i32', 0x80000000), 'i32(-2147483648)');
+  assert.equal(printExpr(op('>', ref('t2', 'i32'), lit('i32', 0x80000000), 'bool')), 't2 > i32(-2147483648)');
+});
+
+test('assignments overwritten before any read are dropped', () => {
+  const x = ref('x', 'f32');
+  const body = [
+    { k: 'set', name: 'l2', e: x },
+    { k: 'set', name: 'l2', e: op('*', x, x, 'f32') }, // read below only on one path
+    { k: 'if', label: 'if0', cond: ref('c', 'bool'), then: [{ k: 'set', name: 'l2', e: lit('f32', 1) }], els: null },
+    { k: 'store', idx: lit('u32', 0), e: ref('l2', 'f32') },
+  ];
+  assert.deepEqual(printBody(propagateCopies(body)).lines, [
+    'l2 = x * x;',
+    'loop { // if0',
+    'if c {',
+    'l2 = 1.0;',
+    '}',
+    'break; // end if0',
+    '}',
+    'mem[0u] = l2;',
+  ]);
+});
+
+test('data segments reachable below their start stay in mem', () => {
+  // mem[((l6 << 2u) + C) / 4u] with a 32-byte table at 1024
+  const load = c => [
+    { k: 'let', name: 't1', type: 'u32', e: op('+', op('<<', ref('l6', 'u32'), lit('u32', 2), 'u32'), lit('u32', c), 'u32') },
+    { k: 'store', idx: lit('u32', 0), e: mem(op('/', ref('t1', 'u32'), lit('u32', 4), 'u32')) },
+  ];
+  const segments = [{ offset: 1024, bytes: new Uint8Array(32).fill(1) }];
+  // table[i]: read from the table, nothing copied
+  const inside = lowerDataSegments(load(1024), segments);
+  assert.deepEqual(inside.copies, []);
+  assert.equal(inside.tables.length, 1);
+  // table[i - 1]: clang's constant is 1020, outside the segment
+  const below = lowerDataSegments(load(1020), segments);
+  assert.deepEqual(below.copies, [{ src: 'data_0', from: 0, to: 256, count: 8 }]);
+});
+
+test('the prologue only takes values that cost more than a load', () => {
+  const t = ref('l5', 'f32');
+  const body = [
+    { k: 'let', name: 't0', type: 'f32', e: op('*', t, lit('f32', 0.5), 'f32') },
+    { k: 'let', name: 't1', type: 'f32', e: call('sin', [t], 'f32') },
+    { k: 'let', name: 't2', type: 'vec2<f32>', e: call('vec2<f32>', [ref('t0', 'f32'), lit('f32', 1)], 'vec2<f32>') },
+    { k: 'let', name: 't3', type: 'f32', e: op('+', op('*', ref('l1', 'f32'), ref('t1', 'f32'), 'f32'), lane(ref('t2', 'vec2<f32>'), 0, 'f32'), 'f32') },
+    { k: 'store', idx: lit('u32', 0), e: ref('t3', 'f32') },
+  ];
+  // sin(iTime) moves; a multiply, and a vector of it, stay per pixel
+  const prologue = extractPrologue(body, new Map([['l5', 'f32']]));
+  assert.deepEqual(prologue.fields, [{ name: 't1', type: 'f32' }]);
+  assert.equal(printBody(body).lines[1], 'let t1: f32 = frame.t1;');
+});
+
+test('br_table arms may leave the function', () => {
+  // block { br_table [0 1] 0 (i32(fragCoord.x)) } mem[l0] = 1.0
+  const body = mainBody(imageModule([
+    0x02, 0x40, 0x20, 1, 0xa8, 0x0e, 1, 0, 1, 0x0b,
+    0x20, 0, 0x43, 0x00, 0x00, 0x80, 0x3f, 0x38, 2, 0,
+  ]));
+  const sw = body.indexOf('switch t0 {');
+  // 0 leaves the block; 1 (the default) leaves the function
+  assert.deepEqual(body.slice(sw, sw + 4), [
+    'switch t0 {',
+    'case 0u: { cf_exit = 2u; cf_cont = 0u; break; }',
+    'default: { cf_exit = 1u; cf_cont = 0u; break; }',
+    '}',
+  ]);
+  // ... to the output write after the body
+  const exit = body.indexOf('break; // end blk1');
+  assert.equal(body[exit + 3], 'cf_exit = 1u; cf_cont = 0u; break;');
+});
+
+test('a return from mainImage still writes the output and the counters', () => {
+  // if (fragCoord.x < 1.0) return; mem[l0] = 1.0
+  const body = mainBody(imageModule([
+    0x20, 1, 0x43, 0x00, 0x00, 0x80, 0x3f, 0x5d, 0x04, 0x40, 0x0f, 0x0b,
+    0x20, 0, 0x43, 0x00, 0x00, 0x80, 0x3f, 0x38, 2, 0,
+  ]), { instrument: true });
+  assert.ok(!body.includes('return;'));
+  assert.deepEqual(body.slice(-2), ['break; // end ret', '}']);
+});
+
+test('functions of the module that use mem are linked in place', () => {
+  // scale(p, k): mem[p] *= k; get(p) -> f32: mem[p] + f32(sp)
+  const scale = { params: [0x7f, 0x7d], results: [], code: [0x20, 0, 0x20, 0, 0x2a, 2, 0, 0x20, 1, 0x94, 0x38, 2, 0] };
+  const get = { params: [0x7f], results: [0x7d], code: [0x20, 0, 0x2a, 2, 0, 0x23, 0, 0xb3, 0x92] };
+  // scale(l0, 3.0); get(l0) (dropped); mem[l0 + 4] = mem[l0]
+  const body = mainBody(imageModule([
+    0x20, 0, 0x43, 0x00, 0x00, 0x40, 0x40, 0x10, 1,
+    0x20, 0, 0x10, 2, 0x1a,
+    0x20, 0, 0x20, 0, 0x2a, 2, 0, 0x38, 2, 4,
+  ], [], [scale, get]));
+  // Both calls stay, in order, before the load; the stack pointer is passed
+  assert.deepEqual(body.slice(0, 3), [
+    'fn_func1(l0, 3.0);',
+    'let t1: f32 = fn_func2(l0, g0);',
+    'let t2: u32 = mem[(l0 + 0u) / 4u];',
+  ]);
+  // A function that moves the stack pointer cannot be linked
+  const push = { params: [], results: [], code: [0x23, 0, 0x41, 16, 0x6b, 0x24, 0] };
+  assert.throws(() => mainBody(imageModule([0x10, 1], [], [push])), /assigns global 0/);
+});
+
+test('supersampled heat has a plane per sample', () => {
+  const bytes = imageModule([0x20, 0, 0x43, 0x00, 0x00, 0x80, 0x3f, 0x38, 2, 0]);
+  const { code } = generateComputeShader(new WasmParser(bytes.buffer).parse({ roots: ['mainImage'] }), { instrument: true, supersample: true });
+  assert.ok(code.includes('heat[(gid.z * H + py) * W + px] = steps;'));
+});
+
+test('scalarized vector math is packed again', () => {
+  const f = n => ref(n, 'f32');
+  const let_ = (name, e) => ({ k: 'let', name, type: 'f32', e });
+  const store = (off, v) => ({ k: 'store', idx: op('/', op('+', ref('l0', 'u32'), lit('u32', off), 'u32'), lit('u32', 4), 'u32'), e: call('bitcast<u32>', [f(v)], 'u32') });
+  const body = [
+    // a.x * b.x + a.y * b.y + a.z * b.z
+    let_('t0', op('*', f('l1'), f('l6'), 'f32')),
+    let_('t1', op('*', f('l2'), f('l7'), 'f32')),
+    let_('t2', op('*', f('l3'), f('l8'), 'f32')),
+    let_('t3', op('+', f('t0'), f('t1'), 'f32')),
+    let_('t4', op('+', f('t3'), f('t2'), 'f32')),
+    store(0, 't4'),
+    // (a + b) * 0.5, stored to three adjacent words
+    ...[0, 1, 2].map(i => let_(`t${5 + i}`, op('+', f(`l${1 + i}`), f(`l${6 + i}`), 'f32'))),
+    ...[0, 1, 2].map(i => let_(`t${8 + i}`, op('*', f(`t${5 + i}`), lit('f32', 0.5), 'f32'))),
+    ...[0, 1, 2].map(i => store(4 + 4 * i, `t${8 + i}`)),
+  ];
+  assert.deepEqual(printBody(vectorize(body)).lines.slice(0, 6), [
+    'let v0: vec3<f32> = vec3<f32>(l1, l2, l3) + vec3<f32>(l6, l7, l8);',
+    'let v1: vec3<f32> = v0 * 0.5;',
+    'let t8: f32 = v1.x;',
+    'let t9: f32 = v1.y;',
+    'let t10: f32 = v1.z;',
+    'let t4: f32 = dot(vec3<f32>(l1, l2, l3), vec3<f32>(l6, l7, l8));',
+  ]);
+});
+
+test('counted loops become for loops, and invariants leave them', () => {
+  // l7 = 1.0; l6 = 0; do { l7 *= l1 * l2; } while (++l6 < 8); mem[l0] = l7
+  const body = mainBody(imageModule([
+    0x41, 0, 0x21, 6, 0x43, 0x00, 0x00, 0x80, 0x3f, 0x21, 7,
+    0x03, 0x40,
+    0x20, 7, 0x20, 1, 0x20, 2, 0x94, 0x94, 0x21, 7,
+    0x20, 6, 0x41, 1, 0x6a, 0x22, 6, 0x41, 8, 0x48, 0x0d, 0,
+    0x0b,
+    0x20, 0, 0x20, 7, 0x38, 2, 0,
+  ], [[1, 0x7f], [1, 0x7d]]));
+  assert.deepEqual(body.slice(2, 6), [
+    'let t2: f32 = l1 * l2;',
+    'var l6: i32;',
+    'for (l6 = 0i; l6 < 8i; l6 = l6 + 1i) { // lp0',
+    'let t3: f32 = l7 * t2;',
+  ]);
+});
+
+test('comparisons stay bool and signed values stay i32', () => {
+  // l6 = i32(fragCoord.x); if (l6 < 3) mem[l0] = f32(l6 / 2)
+  const body = mainBody(imageModule([
+    0x20, 1, 0xa8, 0x21, 6,
+    0x20, 6, 0x41, 3, 0x48, 0x04, 0x40,
+    0x20, 0, 0x20, 6, 0x41, 2, 0x6d, 0xb2, 0x38, 2, 0,
+    0x0b,
+  ], [[1, 0x7f]]));
+  assert.deepEqual(body.slice(0, 4), [
+    'let t0: i32 = i32(trunc(l1));',
+    'let t2: bool = t0 < 3i;',
+    'loop { // if0',
+    'if t2 {',
+  ]);
+  assert.equal(body[4], 'let t4: i32 = t0 / 2i;');
+});
+
+test('byte accesses and memory.fill map to bit ops and a helper', () => {
+  // mem[l0] = f32(load8_u(l0 + 1)); store8(l0 + 2, 7); memory.fill(l0 + 16, 0, 8)
+  const body = mainBody(imageModule([
+    0x20, 0, 0x20, 0, 0x2d, 0, 1, 0xb2, 0x38, 2, 0,
+    0x20, 0, 0x41, 7, 0x3a, 0, 2,
+    0x20, 0, 0x41, 16, 0x6a, 0x41, 0, 0x41, 8, 0xfc, 11, 0,
+  ]));
+  assert.equal(body[1], 'let t1: u32 = extractBits(mem[t0 / 4u], (t0 & 3u) * 8u, 8u);');
+  assert.equal(body[5], 'mem[t4 / 4u] = insertBits(mem[t4 / 4u], 7u, (t4 & 3u) * 8u, 8u);');
+  assert.equal(body[7], 'mem_fill(t6, 0u, 8u);');
+});
+
+test('inlined helpers become built-ins again', () => {
+  const f = n => ref(n, 'f32');
+  const let_ = (name, e) => ({ k: 'let', name, type: 'f32', e });
+  const body = [
+    let_('x', call('bitcast<f32>', [mem(lit('u32', 8))], 'f32')),
+    let_('t0', call('max', [f('x'), lit('f32', 0)], 'f32')),
+    let_('t1', call('min', [f('t0'), lit('f32', 1)], 'f32')),
+    let_('t2', call('floor', [f('x')], 'f32')),
+    let_('t3', op('-', f('x'), f('t2'), 'f32')),
+    let_('t4', op('/', f('x'), lit('f32', 4), 'f32')),
+    let_('t5', op('/', f('x'), lit('f32', 3), 'f32')),
+    let_('t6', op('*', f('t3'), f('t4'), 'f32')),
+    let_('t7', op('+', f('t6'), f('t1'), 'f32')),
+    { k: 'store', idx: lit('u32', 0), e: op('+', f('t7'), f('t5'), 'f32') },
+  ];
+  // 1 / 3 is inexact: that division stays without fastMath
+  assert.deepEqual(printBody(fuseMultiplyAdd(recognizeIdioms(body))).lines.slice(1, 6), [
+    'let t1: f32 = saturate(x);',
+    'let t3: f32 = fract(x);',
+    'let t4: f32 = x * 0.25;',
+    'let t5: f32 = x / 3.0;',
+    'let t7: f32 = fma(t3, t4, t1);',
+  ]);
+});
+
+test('a short skipped branch becomes a select', () => {
+  // l6 = iResolution.x; block { br_if (l1 < l2); l6 = l1 * 2.0 } mem[l0] = l6
+  const body = mainBody(imageModule([
+    0x20, 3, 0x21, 6,
+    0x02, 0x40, 0x20, 1, 0x20, 2, 0x5d, 0x0d, 0, 0x20, 1, 0x43, 0x00, 0x00, 0x00, 0x40, 0x94, 0x21, 6, 0x0b,
+    0x20, 0, 0x20, 6, 0x38, 2, 0,
+  ], [[1, 0x7d]]));
+  assert.deepEqual(body.slice(2), [
+    'let t0: bool = l1 < l2;',
+    'let t2: f32 = l1 * 2.0;',
+    'l6 = select(t2, l6, t0);',
+    'mem[(l0 + 0u) / 4u] = bitcast<u32>(l6);',
+  ]);
+});
+
+test('duplicated loops are outlined into one function', () => {
+  const f = n => ref(n, 'f32');
+  // do { acc = ((acc * x + c) * x + c + 1) ... } while (acc < 100.0), six steps
+  const loop = (k, x, acc, c) => ({ k: 'block', kind: 'loop', label: `lp${k}`, body: [
+    ...[0, 1, 2, 3, 4, 5].map(i => ({ k: 'let', name: `t${k}_${i}`, type: 'f32', e: op('+', op('*', f(i ? `t${k}_${i - 1}` : acc), f(x), 'f32'), lit('f32', c + i), 'f32') })),
+    { k: 'set', name: acc, e: f(`t${k}_5`) },
+    { k: 'br', label: `lp${k}`, cond: op('<', f(acc), lit('f32', 100), 'bool') },
+  ] });
+  const body = [loop(0, 'l1', 'l6', 1), loop(1, 'l2', 'l7', 2), { k: 'store', idx: lit('u32', 0), e: op('+', f('l6'), f('l7'), 'f32') }];
+  const helpers = outlineDuplicates(body);
+  // The assigned local goes by pointer; the literals that differ are parameters
+  assert.deepEqual(printBody(body).lines, [
+    'outlined_0(&(l6), l1, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0);',
+    'outlined_0(&(l7), l2, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0);',
+    'mem[0u] = l6 + l7;',
+  ]);
+  assert.equal(helpers.length, 1);
+  assert.deepEqual(helpers[0].params.map(p => p.ptr), [true, false, false, false, false, false, false, false]);
+});
+
+test('iTime matters only when its entry value reaches memory or a branch', () => {
+  const f = n => ref(n, 'f32');
+  const body = out => [
+    { k: 'let', name: 't0', type: 'f32', e: op('*', f('l5'), lit('f32', 2), 'f32') },
+    { k: 'set', name: 'l6', e: f('t0') },
+    { k: 'store', idx: lit('u32', 0), e: f(out) },
+  ];
+  assert.equal(reachesOutput(body('l1'), 'l5'), false);
+  assert.equal(reachesOutput(body('l6'), 'l5'), true);
+  // clang reuses the parameter local: the value stored is not iTime's
+  const reused = [{ k: 'set', name: 'l5', e: f('l1') }, ...body('l5')];
+  assert.equal(reachesOutput(reused, 'l5'), false);
+  const branch = [{ k: 'if', label: 'if0', cond: op('<', f('l5'), lit('f32', 1), 'bool'), then: body('l1'), els: null }];
+  assert.equal(reachesOutput(branch, 'l5'), true);
+});
+
+test('minifying keeps the names the host binds', () => {
+  // mem[0] = fragCoord.x / iResolution.x
+  const bytes = imageModule([0x20, 0, 0x20, 1, 0x20, 3, 0x95, 0x38, 2, 0]);
+  const { code: src } = generateComputeShader(new WasmParser(bytes.buffer).parse({ roots: ['mainImage'] }), { specializeResolution: true });
+  const { code, names } = minifyWGSL(src);
+  assert.match(code, /@compute@workgroup_size\(8,8\)fn main\(/);
+  assert.match(code, /override RES_W:f32;override RES_H:f32;/);
+  for (const kept of ['main', 'RES_W', 'RES_H']) assert.equal(names.has(kept), false);
+  // Locals, bindings and struct fields are shortened
+  assert.ok(names.has('mem') && names.has('gid'));
+  assert.ok(code.length < src.length);
+});
@@ -3,6 +3,24 @@
 // Converts WASM bytecode into native WGSL instructions (no interpreter loop)
 // =============================================================================
 
+import {
+  ref, lit, op, un, call, mem, bitcast, formatLit, printBody, forEachStmt, forEachExpr, stmtExprs,
+} from './wgsl-ir.js';
+import { propagateCopies, assignedIn } from './passes/propagate.js';
+import { inferTypes } from './passes/types.js';
+import { convertIfs } from './passes/ifconvert.js';
+import { optimizeLoops } from './passes/loops.js';
+import { recognizeIdioms, fuseMultiplyAdd } from './passes/peephole.js';
+import { vectorize } from './passes/slp.js';
+import { reachesOutput } from './passes/taint.js';
+import { extractPrologue, bindInputs } from './passes/uniform.js';
+import { scopeLocals } from './passes/scope.js';
+import { outlineDuplicates } from './passes/outline.js';
+import { lowerDataSegments } from './passes/data.js';
+import { costReport } from './passes/cost.js';
+import { instrumentBlocks } from './passes/instrument.js';
+import { fnv1a, linkModules } from './wasm-parser.js';
+
 // ---- helpers for reading immediates from bytecode ----
 
 function readLebU(bytes, pc) {
@@ -22,22 +40,11 @@ function readLebS(bytes, pc) {
   return r;
 }
 
-function readF32(bytes, pc) {
-  const buf = new ArrayBuffer(4);
-  const u8 = new Uint8Array(buf);
-  u8[0] = bytes[pc.v++]; u8[1] = bytes[pc.v++];
-  u8[2] = bytes[pc.v++]; u8[3] = bytes[pc.v++];
-  return new Float32Array(buf)[0];
-}
-
-function formatF32(val) {
-  if (Object.is(val, -0)) return '-0.0';
-  if (val === Infinity) return '3.40282346638528859812e+38';   // f32 max
-  if (val === -Infinity) return '-3.40282346638528859812e+38'; // f32 min
-  if (Number.isNaN(val)) return '0.0';                         // NaN → 0
-  const s = val.toString();
-  if (s.includes('.') || s.includes('e') || s.includes('E')) return s;
-  return s + '.0';
+// `view`: a DataView over the same bytes
+function readF32(view, pc) {
+  const v = view.getFloat32(pc.v, true);
+  pc.v += 4;
+  return v;
 }
 
 function wgslType(wasmValType) {
@@ -59,19 +66,135 @@ const WGSL_BUILTINS = {
   fminf: 'min', fmaxf: 'max',
 };
 
+// ---- comparison operators: opcode → [WGSL operator, signed] ----
+
+const I32_CMP_OPS = {
+  0x46: ['==', false], 0x47: ['!=', false],
+  0x48: ['<', true],   0x49: ['<', false],
+  0x4a: ['>', true],   0x4b: ['>', false],
+  0x4c: ['<=', true],  0x4d: ['<=', false],
+  0x4e: ['>=', true],  0x4f: ['>=', false],
+};
+
+const F32_CMP_OPS = { 0x5b: '==', 0x5c: '!=', 0x5d: '<', 0x5e: '>', 0x5f: '<=', 0x60: '>=' };
+
+const F32_BIN_OPS = { 0x92: '+', 0x93: '-', 0x94: '*', 0x95: '/' };
+
+// ---- WGSL helpers for bulk memory (emitted only when used) ----
+
+const MEM_HELPERS = {
+  mem_load8: { deps: [], src: `fn mem_load8(addr: u32) -> u32 {
+  return extractBits(mem[addr / 4u], (addr & 3u) * 8u, 8u);
+}` },
+  mem_store8: { deps: [], src: `fn mem_store8(addr: u32, v: u32) {
+  mem[addr / 4u] = insertBits(mem[addr / 4u], v, (addr & 3u) * 8u, 8u);
+}` },
+  // memmove semantics: copies backwards when the destination is above the source
+  mem_copy: { deps: ['mem_load8', 'mem_store8'], src: `fn mem_copy(dst: u32, src: u32, n: u32) {
+  if (((dst | src | n) & 3u) == 0u) {
+    if (dst <= src) {
+      for (var i = 0u; i < n; i += 4u) { mem[(dst + i) / 4u] = mem[(src + i) / 4u]; }
+    } else {
+      for (var i = n; i > 0u; i -= 4u) { mem[(dst + i) / 4u - 1u] = mem[(src + i) / 4u - 1u]; }
+    }
+  } else if (dst <= src) {
+    for (var i = 0u; i < n; i++) { mem_store8(dst + i, mem_load8(src + i)); }
+  } else {
+    for (var i = n; i > 0u; i--) { mem_store8(dst + i - 1u, mem_load8(src + i - 1u)); }
+  }
+}` },
+  // Byte stores up to the first aligned word, whole words, then the tail
+  mem_fill: { deps: ['mem_store8'], src: `fn mem_fill(dst: u32, val: u32, n: u32) {
+  let b = val & 0xffu;
+  var i = 0u;
+  for (; i < n && ((dst + i) & 3u) != 0u; i++) { mem_store8(dst + i, b); }
+  for (; i + 4u <= n; i += 4u) { mem[(dst + i) / 4u] = b * 0x01010101u; }
+  for (; i < n; i++) { mem_store8(dst + i, b); }
+}` },
+};
+
+// ---- per-frame prologue (extractPrologue) ----
+
+// mainImage parameters that are the same for every pixel, and their values
+const FRAME_PARAMS = { l0: '0u', l3: 'uniforms.width', l4: 'uniforms.height', l5: 'uniforms.time' };
+
+// Byte size of a storage struct of scalars and vectors (WGSL layout rules)
+function structSize(types) {
+  const layout = t => (t.startsWith('vec2') ? [8, 8] : t.startsWith('vec3') ? [16, 12] : t.startsWith('vec4') ? [16, 16] : [4, 4]);
+  let offset = 0;
+  let maxAlign = 4;
+  for (const t of types) {
+    const [align, size] = layout(t);
+    offset = Math.ceil(offset / align) * align + size;
+    maxAlign = Math.max(maxAlign, align);
+  }
+  return Math.ceil(offset / maxAlign) * maxAlign;
+}
+
+// Printed lines as the body of a function, in one join
+const indent = lines => (lines.length ? '  ' + lines.join('\n  ') : '');
+
+// ---- WGSL functions: regions outlined by outlineDuplicates(), linked functions ----
+
+// h: { name, params: [{ name, type, ptr? }], body, result?, prelude? }.
+// Returns { src, offsets }: offsets[i] is the bytecode offset of src line i
+function printFunction(h) {
+  const params = h.params.map(p => `${p.name}: ${p.ptr ? `ptr<function, ${p.type}>` : p.type}`).join(', ');
+  const { lines, offsets, needsCfFlags } = printBody(h.body);
+  const head = [...(h.prelude ?? []), ...(needsCfFlags ? ['var cf_exit: u32 = 0u;', 'var cf_cont: u32 = 0u;'] : [])];
+  // WGSL rejects a function with a result that can run off its end, which
+  // a body ending in `unreachable` or in a loop wrapper appears to do
+  const last = h.body[h.body.length - 1];
+  const tail = h.result && last?.k !== 'return' ? [`return ${formatLit(h.result, 0)};`] : [];
+  return {
+    src: `fn ${h.name}(${params})${h.result ? ` -> ${h.result}` : ''} {\n${indent([...head, ...lines, ...tail])}\n}`,
+    offsets: [null, ...head.map(() => null), ...offsets, ...tail.map(() => null), null],
+  };
+}
+
+// DWARF line table row covering `address` (see WasmParser), or null
+function lineAt(table, address) {
+  let lo = 0, hi = table.length - 1, found = -1;
+  while (lo <= hi) {
+    const mid = (lo + hi) >> 1;
+    if (table[mid].address <= address) { found = mid; lo = mid + 1; } else hi = mid - 1;
+  }
+  const row = table[found];
+  return row && !row.end && row.line > 0 ? row : null;
+}
+
+// Where a bytecode offset in the body of `entry` (one of wasm.codes) came
+// from: module offset, function name and, with a DWARF line table, the C++
+// position. An offset of null (code the passes made up) maps to nothing.
+function locator(wasm, entry, func) {
+  return at => {
+    if (at === null) return { offset: null, func, file: null, line: null, column: null };
+    const offset = entry.bodyStart + at;
+    const row = wasm.lineTable && lineAt(wasm.lineTable, offset - wasm.codeStart);
+    return { offset, func, file: row?.file ?? null, line: row?.line ?? null, column: row?.column ?? null };
+  };
+}
+
 // ---- transpile a single function body ----
 
-function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
-  const lines = [];
-  const stack = []; // { name: string, type: 'u32' | 'f32' }
+// `link(funcIdx)`: the WGSL function that a call to funcIdx becomes,
+// { name, params: [types], globals: [indices], result: type or null, mem },
+// or null for an import that linkModules() did not resolve (see Linker);
+// `results`: the function's WASM result types, which `return` and the
+// final `end` hand back.
+function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types, link = null, results = []) {
+  const root = [];
+  let body = root;           // statement list currently being filled
+  const stack = [];          // IR expressions (see wgsl-ir.js)
   const usedGlobals = new Set(); // Track which globals are used
+  const usedHelpers = new Set(); // MEM_HELPERS called by the body
   let tc = 0;
   const pc = { v: 0 };
+  const view = new DataView(bodyBytes.buffer, bodyBytes.byteOffset, bodyBytes.byteLength);
 
   // ---- control flow state ----
-  const labelStack = []; // { kind: 'block'|'loop'|'if', label: string, hasElse?: boolean }
+  const labelStack = []; // { node, parent: enclosing statement list }
   let labelCount = 0;
-  let needsCfFlags = false;
 
   function readBlockType() {
     const bt = bodyBytes[pc.v];
@@ -81,9 +204,19 @@ function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
     return 'void';
   }
 
-  function tmp(type) {
+  // Bind `e` to a fresh `let tN` and return a reference to it
+  function tmp(type, e, note) {
     const name = `t${tc++}`;
-    return { name, type };
+    body.push({ k: 'let', name, type, e, note });
+    return ref(name, type);
+  }
+
+  // Operands still on the stack that read a local/global about to be
+  // overwritten must observe the old value.
+  function snapshot(name) {
+    for (let i = 0; i < stack.length; i++) {
+      if (stack[i].k === 'ref' && stack[i].name === name) stack[i] = tmp(stack[i].type, stack[i]);
+    }
   }
 
   function localT(idx) { return wgslType(allLocalTypes[idx]); }
@@ -97,124 +230,155 @@ function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
     return 'u32';
   }
 
+  const u32 = e => bitcast('u32', e);
+  const f32 = e => bitcast('f32', e);
+  const i32 = e => bitcast('i32', u32(e));
+  const u32Lit = v => lit('u32', v);
+  const bool = e => call('select', [u32Lit(0), u32Lit(1), e], 'u32');
+
+  // mem is word-addressed: (addr + offset) / 4
+  function memIdx(addr) {
+    readLebU(bodyBytes, pc); const off = readLebU(bodyBytes, pc);
+    return op('/', op('+', u32(addr), u32Lit(off), 'u32'), u32Lit(4), 'u32');
+  }
+
+  // Byte k of a sub-word access: the word holding it and its bit offset there
+  function memLane(addr) {
+    readLebU(bodyBytes, pc); const off = readLebU(bodyBytes, pc);
+    const a = tmp('u32', op('+', u32(addr), u32Lit(off), 'u32'));
+    return k => {
+      const b = k ? tmp('u32', op('+', a, u32Lit(k), 'u32')) : a;
+      return { word: () => op('/', b, u32Lit(4), 'u32'), shift: op('*', op('&', b, u32Lit(3), 'u32'), u32Lit(8), 'u32') };
+    };
+  }
+
+  function useHelper(name) {
+    usedHelpers.add(name);
+    for (const d of MEM_HELPERS[name].deps) usedHelpers.add(d);
+  }
+
+  function binU32(o) {
+    const b = stack.pop(); const a = stack.pop();
+    stack.push(tmp('u32', op(o, u32(a), u32(b), 'u32')));
+  }
+
+  function binI32(o) {
+    const b = stack.pop(); const a = stack.pop();
+    stack.push(tmp('u32', u32(op(o, i32(a), i32(b), 'i32'))));
+  }
+
+  function unU32(fn) {
+    stack.push(tmp('u32', call(fn, [u32(stack.pop())], 'u32')));
+  }
+
+  function unF32(fn) {
+    const v = stack.pop();
+    stack.push(tmp('f32', fn === '-' ? un('-', f32(v), 'f32') : call(fn, [f32(v)], 'f32')));
+  }
+
+  function br(depth, cond) {
+    if (depth === labelStack.length) { // the function's own block: return
+      const ret = results.length ? { k: 'return', e: bitcast(wgslType(results[0]), stack.at(-1)) } : { k: 'return' };
+      body.push(cond ? { k: 'if', label: `if${labelCount++}`, cond, then: [ret], els: null } : ret);
+      return;
+    }
+    const target = labelStack[labelStack.length - 1 - depth].node;
+    body.push({ k: 'br', label: target.label, cond });
+  }
+
   while (pc.v < bodyBytes.length) {
-    const op = bodyBytes[pc.v++];
+    // Statements emitted for this instruction remember its offset (`at`)
+    const at = pc.v;
+    const list = body;
+    const emitted = list.length;
+    const opcode = bodyBytes[pc.v++];
 
-    switch (op) {
+    switch (opcode) {
 
       // ---- variables ----
 
       case 0x20: { // local.get
         const idx = readLebU(bodyBytes, pc);
-        stack.push({ name: `l${idx}`, type: localT(idx) });
+        stack.push(ref(`l${idx}`, localT(idx)));
         break;
       }
       case 0x21: { // local.set
         const idx = readLebU(bodyBytes, pc);
         const val = stack.pop();
-        const targetType = localT(idx);
-        let valExpr = val.name;
-        // Handle type mismatch
-        if (val.type !== targetType) {
-          if (targetType === 'f32' && val.type === 'u32') {
-            valExpr = `bitcast<f32>(${val.name})`;
-          } else if (targetType === 'u32' && val.type === 'f32') {
-            valExpr = `bitcast<u32>(${val.name})`;
-          }
-        }
-        lines.push(`l${idx} = ${valExpr};`);
+        snapshot(`l${idx}`);
+        body.push({ k: 'set', name: `l${idx}`, e: bitcast(localT(idx), val) });
         break;
       }
       case 0x22: { // local.tee
         const idx = readLebU(bodyBytes, pc);
-        const val = stack[stack.length - 1];
-        const targetType = localT(idx);
-        let valExpr = val.name;
-        // Handle type mismatch
-        if (val.type !== targetType) {
-          if (targetType === 'f32' && val.type === 'u32') {
-            valExpr = `bitcast<f32>(${val.name})`;
-          } else if (targetType === 'u32' && val.type === 'f32') {
-            valExpr = `bitcast<u32>(${val.name})`;
-          }
-        }
-        lines.push(`l${idx} = ${valExpr};`);
+        const val = stack.pop();
+        snapshot(`l${idx}`);
+        body.push({ k: 'set', name: `l${idx}`, e: bitcast(localT(idx), val) });
+        stack.push(val);
         break;
       }
       case 0x23: { // global.get
         const idx = readLebU(bodyBytes, pc);
-        stack.push({ name: `g${idx}`, type: globalT(idx) });
+        stack.push(ref(`g${idx}`, globalT(idx)));
         break;
       }
       case 0x24: { // global.set
         const idx = readLebU(bodyBytes, pc);
-        usedGlobals.add(idx);
         const val = stack.pop();
-        const targetType = globalT(idx);
-        let valExpr = val.name;
-        // Handle type mismatch
-        if (val.type !== targetType) {
-          if (targetType === 'f32' && val.type === 'u32') {
-            valExpr = `bitcast<f32>(${val.name})`;
-          } else if (targetType === 'u32' && val.type === 'f32') {
-            valExpr = `bitcast<u32>(${val.name})`;
-          }
-        }
-        lines.push(`g${idx} = ${valExpr};`);
+        snapshot(`g${idx}`);
+        body.push({ k: 'set', name: `g${idx}`, e: bitcast(globalT(idx), val) });
         break;
       }
 
       // ---- constants ----
 
       case 0x41: { // i32.const
-        const val = readLebS(bodyBytes, pc);
-        const t = tmp('u32');
-        lines.push(`let ${t.name}: u32 = ${(val >>> 0)}u;`);
-        stack.push(t);
+        stack.push(tmp('u32', u32Lit(readLebS(bodyBytes, pc) >>> 0)));
         break;
       }
       case 0x43: { // f32.const
-        const val = readF32(bodyBytes, pc);
-        const t = tmp('f32');
-        lines.push(`let ${t.name}: f32 = ${formatF32(val)};`);
-        stack.push(t);
+        stack.push(tmp('f32', lit('f32', readF32(view, pc))));
         break;
       }
 
       // ---- memory ----
 
       case 0x28: { // i32.load
-        readLebU(bodyBytes, pc); const off = readLebU(bodyBytes, pc);
-        const addr = stack.pop();
-        const t = tmp('u32');
-        let addrExpr = addr.type === 'f32' ? `bitcast<u32>(${addr.name})` : addr.name;
-        lines.push(`let ${t.name}: u32 = mem[(${addrExpr} + ${off}u) / 4u];`);
-        stack.push(t);
+        const idx = memIdx(stack.pop());
+        stack.push(tmp('u32', mem(idx)));
         break;
       }
       case 0x2a: { // f32.load
-        readLebU(bodyBytes, pc); const off = readLebU(bodyBytes, pc);
-        const addr = stack.pop();
-        const t = tmp('f32');
-        let addrExpr = addr.type === 'f32' ? `bitcast<u32>(${addr.name})` : addr.name;
-        lines.push(`let ${t.name}: f32 = bitcast<f32>(mem[(${addrExpr} + ${off}u) / 4u]);`);
-        stack.push(t);
+        const idx = memIdx(stack.pop());
+        stack.push(tmp('f32', f32(mem(idx))));
         break;
       }
-      case 0x36: { // i32.store
-        readLebU(bodyBytes, pc); const off = readLebU(bodyBytes, pc);
-        const val = stack.pop(); const addr = stack.pop();
-        let addrExpr = addr.type === 'f32' ? `bitcast<u32>(${addr.name})` : addr.name;
-        let valExpr = val.type === 'f32' ? `bitcast<u32>(${val.name})` : val.name;
-        lines.push(`mem[(${addrExpr} + ${off}u) / 4u] = ${valExpr};`);
+      // A 16-bit access is two byte accesses: WASM allows any address, and
+      // one at byte 3 of a word spans two words.
+      case 0x2c: case 0x2d: // i32.load8_s / i32.load8_u
+      case 0x2e: case 0x2f: { // i32.load16_s / i32.load16_u
+        const lane = memLane(stack.pop());
+        const byte = k => { const { word, shift } = lane(k); return call('extractBits', [mem(word()), shift, u32Lit(8)], 'u32'); };
+        let e = byte(0);
+        if (opcode >= 0x2e) e = op('|', e, op('<<', byte(1), u32Lit(8), 'u32'), 'u32');
+        if (!(opcode & 1)) e = u32(call('extractBits', [i32(e), u32Lit(0), u32Lit(opcode < 0x2e ? 8 : 16)], 'i32')); // sign-extends
+        stack.push(tmp('u32', e));
+        break;
+      }
+      case 0x3a: case 0x3b: { // i32.store8 / i32.store16
+        const val = stack.pop();
+        const lane = memLane(stack.pop());
+        for (let k = 0; k < (opcode === 0x3a ? 1 : 2); k++) {
+          const { word, shift } = lane(k);
+          const v = k ? op('>>', u32(val), u32Lit(8), 'u32') : u32(val);
+          body.push({ k: 'store', idx: word(), e: call('insertBits', [mem(word()), v, shift, u32Lit(8)], 'u32') });
+        }
         break;
       }
+      case 0x36: // i32.store
       case 0x38: { // f32.store
-        readLebU(bodyBytes, pc); const off = readLebU(bodyBytes, pc);
         const val = stack.pop(); const addr = stack.pop();
-        let addrExpr = addr.type === 'f32' ? `bitcast<u32>(${addr.name})` : addr.name;
-        let valExpr = val.type === 'u32' ? `bitcast<f32>(${val.name})` : val.name;
-        lines.push(`mem[(${addrExpr} + ${off}u) / 4u] = bitcast<u32>(${valExpr});`);
+        body.push({ k: 'store', idx: memIdx(addr), e: opcode === 0x38 ? u32(f32(val)) : u32(val) });
         break;
       }
 
@@ -225,20 +389,9 @@ function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
         const cond = stack.pop();
         const val2 = stack.pop();
         const val1 = stack.pop();
-        const t = tmp(val1.type);
-        // Ensure both values have the same type for WGSL select
-        let v1 = val1.name;
-        let v2 = val2.name;
-        if (val1.type !== val2.type) {
-          // Type mismatch - coerce to val1's type
-          if (val1.type === 'f32' && val2.type === 'u32') {
-            v2 = `bitcast<f32>(${val2.name})`;
-          } else if (val1.type === 'u32' && val2.type === 'f32') {
-            v2 = `bitcast<u32>(${val2.name})`;
-          }
-        }
-        lines.push(`let ${t.name}: ${t.type} = select(${v2}, ${v1}, ${cond.name} != 0u);`);
-        stack.push(t);
+        // Both values must have the same type for WGSL select - coerce to val1's type
+        const e = call('select', [bitcast(val1.type, val2), val1, op('!=', u32(cond), u32Lit(0), 'bool')], val1.type);
+        stack.push(tmp(val1.type, e));
         break;
       }
 
@@ -246,35 +399,16 @@ function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
 
       case 0x45: { // i32.eqz
         const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        lines.push(`let ${t.name}: u32 = select(0u, 1u, ${aExpr} == 0u);`);
-        stack.push(t);
+        stack.push(tmp('u32', bool(op('==', u32(a), u32Lit(0), 'bool'))));
         break;
       }
       case 0x46: case 0x47: case 0x48: case 0x49:
       case 0x4a: case 0x4b: case 0x4c: case 0x4d:
       case 0x4e: case 0x4f: {
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        // Ensure both operands are u32
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        const cmpOps = {
-          0x46: [`${aExpr}`, '==', `${bExpr}`],
-          0x47: [`${aExpr}`, '!=', `${bExpr}`],
-          0x48: [`bitcast<i32>(${aExpr})`, '<',  `bitcast<i32>(${bExpr})`],
-          0x49: [`${aExpr}`, '<',  `${bExpr}`],
-          0x4a: [`bitcast<i32>(${aExpr})`, '>',  `bitcast<i32>(${bExpr})`],
-          0x4b: [`${aExpr}`, '>',  `${bExpr}`],
-          0x4c: [`bitcast<i32>(${aExpr})`, '<=', `bitcast<i32>(${bExpr})`],
-          0x4d: [`${aExpr}`, '<=', `${bExpr}`],
-          0x4e: [`bitcast<i32>(${aExpr})`, '>=', `bitcast<i32>(${bExpr})`],
-          0x4f: [`${aExpr}`, '>=', `${bExpr}`],
-        };
-        const [la, o, lb] = cmpOps[op];
-        lines.push(`let ${t.name}: u32 = select(0u, 1u, ${la} ${o} ${lb});`);
-        stack.push(t);
+        const [o, signed] = I32_CMP_OPS[opcode];
+        const e = signed ? op(o, i32(a), i32(b), 'bool') : op(o, u32(a), u32(b), 'bool');
+        stack.push(tmp('u32', bool(e)));
         break;
       }
 
@@ -282,231 +416,133 @@ function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
 
       case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f: case 0x60: {
         const b = stack.pop(); const a = stack.pop();
-        const ops = { 0x5b:'==', 0x5c:'!=', 0x5d:'<', 0x5e:'>', 0x5f:'<=', 0x60:'>=' };
-        const t = tmp('u32');
-        // Ensure both operands are f32
-        let aExpr = a.type === 'u32' ? `bitcast<f32>(${a.name})` : a.name;
-        let bExpr = b.type === 'u32' ? `bitcast<f32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = select(0u, 1u, ${aExpr} ${ops[op]} ${bExpr});`);
-        stack.push(t);
+        stack.push(tmp('u32', bool(op(F32_CMP_OPS[opcode], f32(a), f32(b), 'bool'))));
         break;
       }
 
       // ---- i32 arithmetic ----
 
-      case 0x6a: case 0x6b: case 0x6c: {
-        const ops = { 0x6a: '+', 0x6b: '-', 0x6c: '*' };
-        const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        // Ensure both operands are u32
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = ${aExpr} ${ops[op]} ${bExpr};`);
-        stack.push(t);
-        break;
-      }
-      case 0x6d: { // i32.div_s
-        const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = bitcast<u32>(bitcast<i32>(${aExpr}) / bitcast<i32>(${bExpr}));`);
-        stack.push(t);
-        break;
-      }
-      case 0x6f: { // i32.rem_s
-        const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = bitcast<u32>(bitcast<i32>(${aExpr}) % bitcast<i32>(${bExpr}));`);
-        stack.push(t);
-        break;
-      }
-      case 0x71: { // i32.and
-        const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = ${aExpr} & ${bExpr};`);
-        stack.push(t);
-        break;
-      }
-      case 0x72: { // i32.or
-        const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = ${aExpr} | ${bExpr};`);
-        stack.push(t);
-        break;
-      }
-      case 0x73: { // i32.xor
-        const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = ${aExpr} ^ ${bExpr};`);
-        stack.push(t);
-        break;
-      }
+      case 0x67: unU32('countLeadingZeros'); break;  // i32.clz
+      case 0x68: unU32('countTrailingZeros'); break; // i32.ctz
+      case 0x69: unU32('countOneBits'); break;       // i32.popcnt
+      case 0x6a: binU32('+'); break;
+      case 0x6b: binU32('-'); break;
+      case 0x6c: binU32('*'); break;
+      case 0x6d: binI32('/'); break; // i32.div_s
+      case 0x6e: binU32('/'); break; // i32.div_u
+      case 0x6f: binI32('%'); break; // i32.rem_s
+      case 0x70: binU32('%'); break; // i32.rem_u
+      case 0x71: binU32('&'); break;
+      case 0x72: binU32('|'); break;
+      case 0x73: binU32('^'); break;
       case 0x74: { // i32.shl
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = ${aExpr} << (${bExpr} & 31u);`);
-        stack.push(t);
+        stack.push(tmp('u32', op('<<', u32(a), op('&', u32(b), u32Lit(31), 'u32'), 'u32')));
         break;
       }
       case 0x75: { // i32.shr_s
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = bitcast<u32>(bitcast<i32>(${aExpr}) >> (${bExpr} & 31u));`);
-        stack.push(t);
+        stack.push(tmp('u32', u32(op('>>', i32(a), op('&', u32(b), u32Lit(31), 'u32'), 'i32'))));
         break;
       }
       case 0x76: { // i32.shr_u
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('u32');
-        let aExpr = a.type === 'f32' ? `bitcast<u32>(${a.name})` : a.name;
-        let bExpr = b.type === 'f32' ? `bitcast<u32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: u32 = ${aExpr} >> (${bExpr} & 31u);`);
-        stack.push(t);
+        stack.push(tmp('u32', op('>>', u32(a), op('&', u32(b), u32Lit(31), 'u32'), 'u32')));
+        break;
+      }
+      case 0x77: case 0x78: { // i32.rotl / i32.rotr
+        const b = stack.pop(); const a = stack.pop();
+        const [toward, back] = opcode === 0x77 ? ['<<', '>>'] : ['>>', '<<'];
+        const n = op('&', u32(b), u32Lit(31), 'u32');
+        const rest = op('&', op('-', u32Lit(0), u32(b), 'u32'), u32Lit(31), 'u32'); // (32 - n) & 31
+        stack.push(tmp('u32', op('|', op(toward, u32(a), n, 'u32'), op(back, u32(a), rest, 'u32'), 'u32')));
         break;
       }
 
       // ---- f32 unary ----
 
-      case 0x8b: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = abs(${vE});`);   stack.push(t); break; }
-      case 0x8c: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = -(${vE});`);     stack.push(t); break; }
-      case 0x8d: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = ceil(${vE});`);  stack.push(t); break; }
-      case 0x8e: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = floor(${vE});`); stack.push(t); break; }
-      case 0x8f: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = trunc(${vE});`); stack.push(t); break; }
-      case 0x90: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = round(${vE});`); stack.push(t); break; }
-      case 0x91: { const v = stack.pop(); const t = tmp('f32'); const vE = v.type === 'u32' ? `bitcast<f32>(${v.name})` : v.name; lines.push(`let ${t.name}: f32 = sqrt(${vE});`);  stack.push(t); break; }
+      case 0x8b: unF32('abs'); break;
+      case 0x8c: unF32('-'); break;
+      case 0x8d: unF32('ceil'); break;
+      case 0x8e: unF32('floor'); break;
+      case 0x8f: unF32('trunc'); break;
+      case 0x90: unF32('round'); break;
+      case 0x91: unF32('sqrt'); break;
 
       // ---- f32 binary ----
 
       case 0x92: case 0x93: case 0x94: case 0x95: {
-        const ops = { 0x92: '+', 0x93: '-', 0x94: '*', 0x95: '/' };
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('f32');
-        // Ensure both operands are f32
-        let aExpr = a.type === 'u32' ? `bitcast<f32>(${a.name})` : a.name;
-        let bExpr = b.type === 'u32' ? `bitcast<f32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: f32 = ${aExpr} ${ops[op]} ${bExpr};`);
-        stack.push(t);
+        stack.push(tmp('f32', op(F32_BIN_OPS[opcode], f32(a), f32(b), 'f32')));
         break;
       }
-      case 0x96: { // f32.min
+      case 0x96: case 0x97: { // f32.min / f32.max
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('f32');
-        let aExpr = a.type === 'u32' ? `bitcast<f32>(${a.name})` : a.name;
-        let bExpr = b.type === 'u32' ? `bitcast<f32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: f32 = min(${aExpr}, ${bExpr});`);
-        stack.push(t);
+        stack.push(tmp('f32', call(opcode === 0x96 ? 'min' : 'max', [f32(a), f32(b)], 'f32')));
         break;
       }
-      case 0x97: { // f32.max
+      case 0x98: { // f32.copysign
         const b = stack.pop(); const a = stack.pop();
-        const t = tmp('f32');
-        let aExpr = a.type === 'u32' ? `bitcast<f32>(${a.name})` : a.name;
-        let bExpr = b.type === 'u32' ? `bitcast<f32>(${b.name})` : b.name;
-        lines.push(`let ${t.name}: f32 = max(${aExpr}, ${bExpr});`);
-        stack.push(t);
+        const magnitude = op('&', u32(a), u32Lit(0x7fffffff), 'u32');
+        const sign = op('&', u32(b), u32Lit(0x80000000), 'u32');
+        stack.push(tmp('f32', f32(op('|', magnitude, sign, 'u32'))));
         break;
       }
 
       // ---- conversions ----
 
       case 0xa8: { // i32.trunc_f32_s
-        const v = stack.pop(); const t = tmp('u32');
-        if (v.type === 'f32') {
-          lines.push(`let ${t.name}: u32 = bitcast<u32>(i32(trunc(${v.name})));`);
-        } else {
-          // Already an integer, just do signed reinterpret
-          lines.push(`let ${t.name}: u32 = ${v.name};`);
-        }
-        stack.push(t);
+        // An integer operand is already truncated, just do signed reinterpret
+        const v = stack.pop();
+        stack.push(tmp('u32', v.type === 'f32' ? u32(call('i32', [call('trunc', [v], 'f32')], 'i32')) : v));
         break;
       }
       case 0xa9: { // i32.trunc_f32_u
-        const v = stack.pop(); const t = tmp('u32');
-        if (v.type === 'f32') {
-          lines.push(`let ${t.name}: u32 = u32(trunc(${v.name}));`);
-        } else {
-          lines.push(`let ${t.name}: u32 = ${v.name};`);
-        }
-        stack.push(t);
+        const v = stack.pop();
+        stack.push(tmp('u32', v.type === 'f32' ? call('u32', [call('trunc', [v], 'f32')], 'u32') : v));
         break;
       }
       case 0xb2: { // f32.convert_i32_s
-        const v = stack.pop(); const t = tmp('f32');
-        if (v.type === 'u32') {
-          lines.push(`let ${t.name}: f32 = f32(bitcast<i32>(${v.name}));`);
-        } else {
-          // Already f32
-          lines.push(`let ${t.name}: f32 = ${v.name};`);
-        }
-        stack.push(t);
+        const v = stack.pop();
+        stack.push(tmp('f32', v.type === 'u32' ? call('f32', [i32(v)], 'f32') : v));
         break;
       }
       case 0xb3: { // f32.convert_i32_u
-        const v = stack.pop(); const t = tmp('f32');
-        if (v.type === 'u32') {
-          lines.push(`let ${t.name}: f32 = f32(${v.name});`);
-        } else {
-          lines.push(`let ${t.name}: f32 = ${v.name};`);
-        }
-        stack.push(t);
+        const v = stack.pop();
+        stack.push(tmp('f32', v.type === 'u32' ? call('f32', [v], 'f32') : v));
         break;
       }
       case 0xbc: { // i32.reinterpret_f32
-        const v = stack.pop();
-        const t = tmp('u32');
-        if (v.type === 'f32') {
-          lines.push(`let ${t.name}: u32 = bitcast<u32>(${v.name});`);
-        } else {
-          lines.push(`let ${t.name}: u32 = ${v.name};`);
-        }
-        stack.push(t);
+        stack.push(tmp('u32', u32(stack.pop())));
         break;
       }
       case 0xbe: { // f32.reinterpret_i32
-        const v = stack.pop();
-        const t = tmp('f32');
-        if (v.type === 'u32') {
-          lines.push(`let ${t.name}: f32 = bitcast<f32>(${v.name});`);
-        } else {
-          lines.push(`let ${t.name}: f32 = ${v.name};`);
-        }
-        stack.push(t);
+        stack.push(tmp('f32', f32(stack.pop())));
         break;
       }
 
-      // ---- 0xFC prefix (saturating truncations) ----
+      // ---- 0xFC prefix (saturating truncations, bulk memory) ----
 
       case 0xfc: {
         const sub = readLebU(bodyBytes, pc);
         if (sub === 0) { // i32.trunc_sat_f32_s
-          const v = stack.pop(); const t = tmp('u32');
-          if (v.type === 'f32') {
-            lines.push(`let ${t.name}: u32 = bitcast<u32>(i32(trunc(${v.name})));`);
-          } else {
-            lines.push(`let ${t.name}: u32 = ${v.name};`);
-          }
-          stack.push(t);
+          const v = stack.pop();
+          stack.push(tmp('u32', v.type === 'f32' ? u32(call('i32', [call('trunc', [v], 'f32')], 'i32')) : v));
         } else if (sub === 1) { // i32.trunc_sat_f32_u
-          const v = stack.pop(); const t = tmp('u32');
-          if (v.type === 'f32') {
-            lines.push(`let ${t.name}: u32 = u32(trunc(${v.name}));`);
-          } else {
-            lines.push(`let ${t.name}: u32 = ${v.name};`);
-          }
-          stack.push(t);
+          const v = stack.pop();
+          stack.push(tmp('u32', v.type === 'f32' ? call('u32', [call('trunc', [v], 'f32')], 'u32') : v));
+        } else if (sub === 10) { // memory.copy
+          pc.v += 2; // destination and source memory indices
+          const n = stack.pop(); const src = stack.pop(); const dst = stack.pop();
+          useHelper('mem_copy');
+          body.push({ k: 'expr', e: call('mem_copy', [u32(dst), u32(src), u32(n)], 'void') });
+        } else if (sub === 11) { // memory.fill
+          pc.v += 1; // memory index
+          const n = stack.pop(); const val = stack.pop(); const dst = stack.pop();
+          useHelper('mem_fill');
+          body.push({ k: 'expr', e: call('mem_fill', [u32(dst), u32(val), u32(n)], 'void') });
+        } else {
+          console.warn(`Transpiler: unhandled opcode 0xfc ${sub} at offset ${pc.v - 1}`);
         }
         break;
       }
@@ -516,149 +552,265 @@ function transpileBody(bodyBytes, allLocalTypes, globals, funcImports, types) {
       case 0x10: { // call
         const funcIdx = readLebU(bodyBytes, pc);
         const numImports = funcImports ? funcImports.length : 0;
-        if (funcIdx < numImports) {
+        const builtin = funcIdx < numImports && WGSL_BUILTINS[funcImports[funcIdx].name];
+        const target = !builtin && link ? link(funcIdx) : null;
+        if (target) {
+          // WASM arguments, then the globals the function reads
+          const args = stack.splice(stack.length - (target.params.length - target.globals.length)).map((a, i) => bitcast(target.params[i], a));
+          for (const g of target.globals) args.push(ref(`g${g}`, globalT(g)));
+          const e = call(target.name, args, target.result ?? 'void');
+          if (target.mem) e.mem = true;
+          if (target.result) stack.push(tmp(target.result, e));
+          else body.push({ k: 'expr', e });
+        } else if (funcIdx < numImports) {
           const imp = funcImports[funcIdx];
           const wgslName = WGSL_BUILTINS[imp.name];
           const funcType = types[imp.typeIdx];
+          const args = stack.splice(stack.length - funcType.params.length);
           if (wgslName) {
-            const args = [];
-            for (let j = 0; j < funcType.params.length; j++) {
-              args.unshift(stack.pop());
-            }
-            const argStr = args.map(a =>
-              a.type === 'u32' ? `bitcast<f32>(${a.name})` : a.name
-            ).join(', ');
-            if (funcType.results.length > 0) {
-              const t = tmp('f32');
-              lines.push(`let ${t.name}: f32 = ${wgslName}(${argStr});`);
-              stack.push(t);
-            } else {
-              lines.push(`${wgslName}(${argStr});`);
-            }
+            const e = call(wgslName, args.map(f32), 'f32');
+            if (funcType.results.length > 0) stack.push(tmp('f32', e));
+            else body.push({ k: 'expr', e });
           } else {
             console.warn(`Transpiler: unknown import "${imp.name}" at funcIdx ${funcIdx}`);
-            const funcType2 = types[imp.typeIdx];
-            for (let j = 0; j < funcType2.params.length; j++) stack.pop();
-            if (funcType2.results.length > 0) {
-              const t = tmp('f32');
-              lines.push(`let ${t.name}: f32 = 0.0; // unknown import: ${imp.name}`);
-              stack.push(t);
-            }
+            if (funcType.results.length > 0) stack.push(tmp('f32', lit('f32', 0), `unknown import: ${imp.name}`));
           }
         } else {
-          console.warn(`Transpiler: call to local function ${funcIdx} not supported`);
+          throw new Error(`Transpiler: call to local function ${funcIdx} cannot be linked`);
         }
         break;
       }
 
       // ---- control flow ----
 
-      case 0x02: { // block
-        readBlockType();
-        const label = `blk${labelCount++}`;
-        labelStack.push({ kind: 'block', label });
-        lines.push(`loop { // ${label}`);
-        break;
-      }
+      case 0x02: // block
       case 0x03: { // loop
         readBlockType();
-        const label = `lp${labelCount++}`;
-        labelStack.push({ kind: 'loop', label });
-        lines.push(`loop { // ${label}`);
+        const kind = opcode === 0x02 ? 'block' : 'loop';
+        const node = { k: 'block', kind, label: `${opcode === 0x02 ? 'blk' : 'lp'}${labelCount++}`, body: [] };
+        body.push(node);
+        labelStack.push({ node, parent: body });
+        body = node.body;
         break;
       }
       case 0x04: { // if
         readBlockType();
         const cond = stack.pop();
-        const label = `if${labelCount++}`;
-        let condExpr = cond.type === 'f32' ? `bitcast<u32>(${cond.name})` : cond.name;
-        labelStack.push({ kind: 'if', label, hasElse: false });
-        lines.push(`loop { // ${label}`);
-        lines.push(`if ${condExpr} != 0u {`);
+        const node = { k: 'if', label: `if${labelCount++}`, cond, then: [], els: null };
+        body.push(node);
+        labelStack.push({ node, parent: body });
+        body = node.then;
         break;
       }
       case 0x05: { // else
-        const top = labelStack[labelStack.length - 1];
-        top.hasElse = true;
-        lines.push(`} else {`);
+        const top = labelStack[labelStack.length - 1].node;
+        top.els = [];
+        body = top.els;
         break;
       }
       case 0x0b: { // end
-        if (labelStack.length === 0) break; // end of function
-        const entry = labelStack.pop();
-        if (entry.kind === 'if') {
-          lines.push(`}`); // close if or else
-          lines.push(`break; // end ${entry.label}`);
-          lines.push(`}`); // close loop wrapper
-        } else {
-          lines.push(`break; // end ${entry.label}`);
-          lines.push(`}`); // close loop
-        }
-        // Flag check for multi-level br propagation
-        if (needsCfFlags && labelStack.length > 0) {
-          lines.push(`if cf_exit > 0u { cf_exit = cf_exit - 1u; if cf_exit == 0u && cf_cont == 1u { continue; } else { break; } }`);
+        if (labelStack.length === 0) { // end of function
+          if (results.length && stack.length) body.push({ k: 'return', e: bitcast(wgslType(results[0]), stack.pop()) });
+          break;
         }
+        body = labelStack.pop().parent;
         break;
       }
       case 0x0c: { // br
-        const depth = readLebU(bodyBytes, pc);
-        const target = labelStack[labelStack.length - 1 - depth];
-        if (depth === 0) {
-          lines.push(target.kind === 'loop' ? `continue;` : `break;`);
-        } else {
-          needsCfFlags = true;
-          lines.push(`cf_exit = ${depth}u; cf_cont = ${target.kind === 'loop' ? '1u' : '0u'}; break;`);
-        }
+        br(readLebU(bodyBytes, pc), null);
         break;
       }
       case 0x0d: { // br_if
         const depth = readLebU(bodyBytes, pc);
-        const cond = stack.pop();
-        const target = labelStack[labelStack.length - 1 - depth];
-        let condExpr = cond.type === 'f32' ? `bitcast<u32>(${cond.name})` : cond.name;
-        if (depth === 0) {
-          lines.push(`if ${condExpr} != 0u { ${target.kind === 'loop' ? 'continue' : 'break'}; }`);
-        } else {
-          needsCfFlags = true;
-          lines.push(`if ${condExpr} != 0u { cf_exit = ${depth}u; cf_cont = ${target.kind === 'loop' ? '1u' : '0u'}; break; }`);
-        }
+        br(depth, stack.pop());
+        break;
+      }
+      case 0x0e: { // br_table
+        const n = readLebU(bodyBytes, pc);
+        const depths = [];
+        for (let i = 0; i <= n; i++) depths.push(readLebU(bodyBytes, pc));
+        const sel = u32(stack.pop());
+        // Arms that leave the function's own block return (as in br()):
+        // they exit a block wrapped around the switch, and the return
+        // follows it.
+        const exit = depths.includes(labelStack.length) ? { k: 'block', kind: 'block', label: `blk${labelCount++}`, body: [] } : null;
+        const labelAt = depth => (depth === labelStack.length ? exit.label : labelStack[labelStack.length - 1 - depth].node.label);
+        const sw = { k: 'switch', sel, targets: depths.slice(0, n).map(labelAt), def: labelAt(depths[n]) };
+        if (!exit) { body.push(sw); break; }
+        exit.body.push(sw);
+        body.push(exit, results.length ? { k: 'return', e: bitcast(wgslType(results[0]), stack.at(-1)) } : { k: 'return' });
         break;
       }
       case 0x0f: { // return
-        lines.push(`return;`);
+        body.push(results.length ? { k: 'return', e: bitcast(wgslType(results[0]), stack.pop()) } : { k: 'return' });
         break;
       }
       case 0x00: break; // unreachable
       case 0x01: break; // nop
 
       default:
-        console.warn(`Transpiler: unhandled opcode 0x${op.toString(16)} at offset ${pc.v - 1}`);
+        console.warn(`Transpiler: unhandled opcode 0x${opcode.toString(16)} at offset ${pc.v - 1}`);
     }
+    for (let i = emitted; i < list.length; i++) list[i].at ??= at;
   }
 
-  return { lines, usedGlobals, needsCfFlags };
+  return { body: root, usedGlobals, usedHelpers };
 }
 
-// ---- generate the complete compute shader ----
+// ---- functions called by mainImage ----
+//
+// A call to a function defined in the module, or to an import that
+// linkModules() resolved to another module's export, becomes a call to a WGSL
+// function, transpiled once and optimized like mainImage. A function of the
+// shader module shares its linear memory, `mem`: it may load, store and use
+// the memory helpers, and the globals it reads (the stack pointer) are
+// passed as extra arguments after its own. Its calls are marked `mem` (see
+// wgsl-ir.js), which the passes keep in place. A function that assigns a
+// global is not linked, since the caller would not see the new value. Each
+// other module has its own memory and stack pointer, so functions imported
+// from one must compute from their arguments alone. A call that cannot be
+// linked is an error.
+class Linker {
+  // fastMath: see options.fastMath; home: the shader module, whose memory is
+  // `mem`
+  constructor(fastMath = false, home = null) {
+    this.fastMath = fastMath;
+    this.home = home;
+    this.fns = [];            // linked functions, callees first (see printFunction)
+    this.done = new Map();    // module → Map(funcIdx → function, or null when not linkable)
+    this.names = new Set();
+  }
 
-export function generateComputeShader(wasm) {
-  const mainExport = wasm.exports.find(e => e.name === 'mainImage' && e.kind === 0);
-  if (!mainExport) throw new Error('No mainImage export found');
+  // The transpileBody `link` callback for calls made in `wasm`
+  resolver(wasm) {
+    return funcIdx => this.#resolve(wasm, funcIdx);
+  }
+
+  #resolve(wasm, funcIdx) {
+    const numImports = wasm.imports.filter(i => i.kind === 0).length;
+    if (funcIdx < numImports) {
+      const target = wasm.links?.get(funcIdx);
+      return target ? this.#resolve(target.wasm, target.index) : null;
+    }
+    if (!this.done.has(wasm)) this.done.set(wasm, new Map());
+    const done = this.done.get(wasm);
+    if (done.has(funcIdx)) {
+      const f = done.get(funcIdx);
+      if (f === undefined) throw new Error(`Transpiler: recursive call to ${this.#name(wasm, funcIdx)} cannot be linked`);
+      return f.target;
+    }
+    done.set(funcIdx, undefined); // in progress
+    const f = this.#link(wasm, funcIdx, numImports);
+    done.set(funcIdx, f);
+    this.fns.push(f);
+    return f.target;
+  }
+
+  #name(wasm, funcIdx) {
+    return wasm.names?.functions.get(funcIdx) ??
+      wasm.exports.find(e => e.kind === 0 && e.index === funcIdx)?.name ?? `func${funcIdx}`;
+  }
+
+  #link(wasm, funcIdx, numImports) {
+    const func = this.#name(wasm, funcIdx);
+    const entry = wasm.codes[funcIdx - numImports];
+    const type = wasm.types[wasm.functions[funcIdx - numImports]];
+    if (!entry.bodyBytes) throw new Error(`Transpiler: ${func} was not decoded (parse with roots that reach it)`);
+    if (type.results.length > 1) throw new Error(`Transpiler: ${func} returns several values and cannot be linked`);
+    const allLocalTypes = [...type.params, ...entry.localTypes];
+    let complete = true;
+    const link = i => this.#resolve(wasm, i) ?? (complete = false, null);
+    const funcImports = wasm.imports.filter(i => i.kind === 0);
+    const { body, usedGlobals, usedHelpers } = transpileBody(entry.bodyBytes, allLocalTypes, wasm.globals, funcImports, wasm.types, link, type.results);
+    let usesMem = usedHelpers.size > 0;
+    forEachStmt(body, s => {
+      if (s.k === 'store') usesMem = true;
+      for (const e of stmtExprs(s)) forEachExpr(e, n => { if (n.k === 'mem' || (n.k === 'call' && n.mem)) usesMem = true; });
+    });
+    if (wasm !== this.home && (!complete || usedGlobals.size || usesMem)) {
+      throw new Error(`Transpiler: ${func} is imported from another module and uses its memory, globals or imports; cannot be linked`);
+    }
+    const globals = [...usedGlobals].sort((a, b) => a - b);
+    const sets = assignedIn(body);
+    const written = globals.find(g => sets.has(`g${g}`));
+    if (written !== undefined) throw new Error(`Transpiler: ${func} assigns global ${written} and cannot be linked`);
+
+    propagateCopies(body);
+    const params = type.params.map(wgslType);
+    const globalTypes = globals.map(g => (wasm.globals?.[g]?.type === 0x7d ? 'f32' : 'u32'));
+    const varTypes = inferTypes(body, new Set([...params.map((_, i) => `l${i}`), ...globals.map(g => `g${g}`)]));
+    convertIfs(body);
+    optimizeLoops(body);
+    recognizeIdioms(body, undefined, this.fastMath);
+    vectorize(body);
+    fuseMultiplyAdd(body);
+    const locals = new Map();
+    for (let i = params.length; i < allLocalTypes.length; i++) {
+      locals.set(`l${i}`, varTypes.get(`l${i}`) || wgslType(allLocalTypes[i]));
+    }
+    scopeLocals(body, locals);
+
+    const base = `fn_${func.replace(/\(.*$/, '').replace(/\W/g, '_')}`;
+    let name = base;
+    for (let k = 2; this.names.has(name); k++) name = `${base}_${k}`;
+    this.names.add(name);
+    // WGSL parameters are immutable: assigned ones are copied into a var
+    const assigned = assignedIn(body);
+    const result = type.results.length ? wgslType(type.results[0]) : null;
+    return {
+      name, body, result, func, usedHelpers,
+      params: [
+        ...params.map((t, i) => ({ name: assigned.has(`l${i}`) ? `p${i}` : `l${i}`, type: t })),
+        ...globals.map((g, i) => ({ name: `g${g}`, type: globalTypes[i] })),
+      ],
+      prelude: params.flatMap((t, i) => (assigned.has(`l${i}`) ? [`var l${i}: ${t} = p${i};`] : [])),
+      target: { name, params: [...params, ...globalTypes], globals, result, mem: usesMem },
+      locate: locator(wasm, entry, func),
+    };
+  }
+}
+
+// ---- one exported image function → the IR of one entry point ----
+
+// Transpiles and optimizes `name` (an export with mainImage's signature) as
+// entry point `index` of the shader: `main` and `prologue` for the first,
+// `main_<name>` and `prologue_<name>` for the others. Its calls go through
+// the shared `linker`; its outlined helpers are numbered from
+// `firstOutlined`.
+function compileEntry(wasm, name, index, linker, firstOutlined, options) {
+  const specialize = !!options.specializeResolution;
+  const mainExport = wasm.exports.find(e => e.name === name && e.kind === 0);
+  if (!mainExport) throw new Error(`No ${name} export found`);
   const mainFuncIdx = mainExport.index;
 
   const numImportedFuncs = wasm.imports.filter(i => i.kind === 0).length;
   const codeIdx = mainFuncIdx - numImportedFuncs;
   const entry = wasm.codes[codeIdx];
+  if (!entry.bodyBytes) throw new Error(`${name} was not decoded (parse with roots including ${name})`);
   const typeIdx = wasm.functions[codeIdx];
   const type = wasm.types[typeIdx];
 
   const allLocalTypes = [...type.params, ...entry.localTypes];
   const funcImports = wasm.imports.filter(i => i.kind === 0);
-  const { lines: bodyLines, usedGlobals, needsCfFlags } = transpileBody(entry.bodyBytes, allLocalTypes, wasm.globals, funcImports, wasm.types);
+  const { body, usedGlobals, usedHelpers } = transpileBody(entry.bodyBytes, allLocalTypes, wasm.globals, funcImports, wasm.types, linker.resolver(wasm));
+  // The body is printed inline, ahead of the output write (and the counter
+  // flush): a `return` leaves a block around it instead of the function
+  let returns = false;
+  forEachStmt(body, s => {
+    if (s.k !== 'return') return;
+    Object.assign(s, { k: 'br', label: 'ret', cond: null });
+    returns = true;
+  });
+  const ir = returns ? [{ k: 'block', kind: 'block', label: 'ret', body }] : body;
+  // A profile belongs to the function it was recorded from
+  let profile = (options.profile?.function ?? 'mainImage') === name ? options.profile : null;
+  if (profile && (profile.bodySize !== entry.bodyBytes.length || profile.checksum !== fnv1a(entry.bodyBytes))) {
+    console.warn(`Transpiler: profile was recorded from a different build of ${name}; ignored`);
+    profile = null;
+  }
 
-  // Declare global variables that are used
-  const globalDecls = Array.from(usedGlobals).sort((a, b) => a - b).map(idx => {
-    // Get initial value from wasm.globals if available
+  // Type and initial value of each global that is used
+  const globalInfo = new Map([...usedGlobals].sort((a, b) => a - b).map(idx => {
     let initValStr = '65536u'; // Default stack pointer value
     let globalType = 'u32';
     if (wasm.globals && wasm.globals[idx]) {
@@ -668,66 +820,365 @@ export function generateComputeShader(wasm) {
         initValStr = globalType === 'f32' ? `${g.initVal}` : `${g.initVal >>> 0}u`;
       }
     }
-    return `  var g${idx}: ${globalType} = ${initValStr};`;
-  }).join('\n');
+    return [`g${idx}`, { type: globalType, init: initValStr }];
+  }));
 
-  // Declare local variables with proper types
-  const localDecls = allLocalTypes.map((t, i) => {
-    const wt = wgslType(t);
-    const init = wt === 'u32' ? '0u' : '0.0';
-    return `  var l${i}: ${wt} = ${init};`;
-  }).join('\n');
+  if (specialize) bindInputs(ir, new Map(Object.entries(RES_OVERRIDES)));
+  propagateCopies(ir);
+  // The stack pointer and fragColor point outside the data segments
+  const data = lowerDataSegments(ir, (wasm.data || []).filter(d => d.offset !== null), new Set(['l0', ...[...usedGlobals].map(i => `g${i}`)]));
+  // Parameters and globals are initialized by the template at their WASM type
+  const fixed = new Set([...type.params.map((_, i) => `l${i}`), ...[...usedGlobals].map(i => `g${i}`)]);
+  const varTypes = inferTypes(ir, fixed);
+  convertIfs(ir, profile);
+  optimizeLoops(ir);
+  recognizeIdioms(ir, new Set(specialize ? Object.values(RES_OVERRIDES) : []), !!options.fastMath);
+  vectorize(ir);
+  fuseMultiplyAdd(ir);
+  const timeDependent = reachesOutput(ir, 'l5'); // iTime
+  const frameInputs = new Map(Object.keys(FRAME_PARAMS).map(n => [n, wgslType(allLocalTypes[+n.slice(1)])]));
+  for (const [name, g] of globalInfo) frameInputs.set(name, g.type);
+  if (specialize) for (const n of Object.keys(RES_OVERRIDES)) frameInputs.delete(n);
+  const tag = name.replace(/\W/g, '_');
+  const prologue = extractPrologue(ir, frameInputs, new Set(specialize ? Object.values(RES_OVERRIDES) : []), index ? `${tag}_` : '');
+  const locals = new Map();
+  for (let i = type.params.length; i < allLocalTypes.length; i++) {
+    locals.set(`l${i}`, varTypes.get(`l${i}`) || wgslType(allLocalTypes[i]));
+  }
+  scopeLocals(ir, locals);
+  const outlined = outlineDuplicates(ir, profile, firstOutlined);
+  // Private memory besides body locals: mem, parameters, globals. Measured
+  // before instrumentation: the report is about the real shader.
+  const report = costReport(ir, [...linker.fns, ...outlined], MEM_WORDS * 4 + 4 * (type.params.length + globalInfo.size));
+  return {
+    name, main: index ? `main_${tag}` : 'main', prologueName: prologue && (index ? `prologue_${tag}` : 'prologue'),
+    ir, type, globalInfo, usedHelpers, data, frameInputs, prologue, outlined, timeDependent, report,
+    locate: locator(wasm, entry, wasm.names?.functions.get(mainFuncIdx) ?? name),
+  };
+}
 
-  // Control flow flag variables (for multi-level br propagation)
-  const cfDecls = needsCfFlags
-    ? '  var cf_exit: u32 = 0u;\n  var cf_cont: u32 = 0u;\n'
-    : '';
+// ---- generate the complete compute shader ----
 
-  const body = bodyLines.map(l => '  ' + l).join('\n');
+// Size of the per-invocation linear memory, in words
+const MEM_WORDS = 4096;
 
-  return `struct Uniforms {
-  time: f32,
-  width: f32,
-  height: f32,
-  pad: u32,
+// u32 literals of a data table, eight to a line
+function formatWords(words) {
+  const lines = [];
+  for (let i = 0; i < words.length; i += 8) {
+    lines.push('  ' + Array.from(words.subarray(i, i + 8), w => formatLit('u32', w)).join(', '));
+  }
+  return `\n${lines.join(',\n')}\n`;
 }
 
-@group(0) @binding(0) var<storage, read_write> output: array<f32>;
-@group(0) @binding(1) var<uniform> uniforms: Uniforms;
+// Pipeline-overridable constants for resolution-specialized shaders
+const RES_OVERRIDES = { l3: 'RES_W', l4: 'RES_H' };
 
-@compute @workgroup_size(8, 8)
-fn main(@builtin(global_invocation_id) gid: vec3<u32>) {
+// Vertex stage of the fragment target: one triangle that covers the screen
+const FULLSCREEN_VS = `
+@vertex
+fn vs(@builtin(vertex_index) i: u32) -> @builtin(position) vec4<f32> {
+  return vec4(f32(i & 1u) * 4.0 - 1.0, f32(i >> 1u) * 4.0 - 1.0, 0.0, 1.0);
+}
+`;
+
+// Position in the pixel of sample gid.z: the R2 low-discrepancy sequence,
+// which covers the pixel evenly for any sample count and starts at its
+// centre, so that one sample renders exactly what a plain shader does
+const SAMPLE_JITTER = 'fract(vec2(0.5) + f32(gid.z) * vec2(0.7548776662, 0.5698402910))';
+
+// options.specializeResolution: read iResolution from the `override`
+// constants RES_W / RES_H instead of the uniforms, so that everything derived
+// from it folds when the pipeline is created. The caller builds one pipeline
+// per size with `constants: { RES_W, RES_H }`.
+// options.fastMath: divide by constants (and by RES_W / RES_H) as a multiply
+// by their reciprocal even when that is not exact; a value can move by an
+// ulp, and a floor() of it by a whole step. Reciprocals of powers of two,
+// which are exact, are always used.
+// options.profile: a profile of mainImage (or of the entry point named by
+// its `function`) written by profile.mjs; branch and block counts steer
+// if-conversion and outlining. Ignored, with a warning, when it was
+// recorded from a different build.
+// options.instrument: count basic block executions into the `counters`
+// buffer (binding 5) and each pixel's loop iterations into `heat` (binding
+// 4), one W * H plane per sample when supersampled; see
+// passes/instrument.js.
+// options.supersample: one invocation per sample — gid.z is the sample
+// index, fragCoord is jittered by it (see SAMPLE_JITTER) and each sample
+// writes its own plane of `output`, W * H * 4 floats from sample * W * H * 4.
+// The caller dispatches uniforms.samples layers and averages the planes.
+// options.persistent: each entry point is a loop run by a fixed number of
+// workgroups, which take 8x8 tiles (and, supersampled, sample layers) from
+// the atomic counter `queue` (binding 6, zeroed before every dispatch) until
+// none are left, and shade them with shade() — the per-pixel body, called
+// once per pixel. Expensive tiles then hold back only the workgroup that
+// drew them. Note that `mem` carries over from one pixel to the next, as
+// WASM linear memory does between calls.
+// options.entryPoints: exported image functions to emit, each with
+// mainImage's signature (default ['mainImage']). They become entry points
+// of one module (see compileEntry) that share helper and linked functions,
+// data tables and the bind group layout — their Frame fields sit side by
+// side in one struct — so switching between them switches pipelines only.
+// `wasm`: a parsed module, or an array [shader, ...libraries] of them whose
+// imports resolve to each other's exports (see linkModules, Linker).
+export function generateComputeShader(wasm, options = {}) {
+  return generateShader(wasm, options, 'compute');
+}
+
+// The same image functions as fragment shaders, `fs` (and `fs_<name>` for
+// further entry points) after the full-screen triangle `vs`, returning the
+// pixel's colour: no output buffer and no second pass. Per-frame prologues
+// stay compute entry points of the module. Takes the options of
+// generateComputeShader() except those that need the compute pass —
+// instrument, supersample and persistent.
+export function generateFragmentShader(wasm, options = {}) {
+  for (const o of ['instrument', 'supersample', 'persistent']) {
+    if (options[o]) throw new Error(`generateFragmentShader: options.${o} needs generateComputeShader`);
+  }
+  return generateShader(wasm, options, 'fragment');
+}
+
+function generateShader(wasm, options, target) {
+  if (Array.isArray(wasm)) wasm = linkModules(wasm)[0];
+  const specialize = !!options.specializeResolution;
+  const instrument = !!options.instrument;
+  const supersample = !!options.supersample;
+  const persistent = !!options.persistent;
+  const fragment = target === 'fragment';
+  const linker = new Linker(!!options.fastMath, wasm);
+  const entries = [];
+  for (const [i, name] of (options.entryPoints ?? ['mainImage']).entries()) {
+    entries.push(compileEntry(wasm, name, i, linker, entries.reduce((n, e) => n + e.outlined.length, 0), options));
+  }
+  if (fragment) for (const e of entries) e.main = e.main.replace(/^main/, 'fs');
+  const linked = linker.fns;
+  let blocks = null;
+  if (instrument) {
+    blocks = [];
+    const bodies = [
+      ...entries.flatMap(e => [[e.main, e.ir, e.locate], ...e.outlined.map(h => [h.name, h.body, e.locate])]),
+      ...linked.map(f => [f.name, f.body, f.locate]),
+    ];
+    for (const [fn, b, loc] of bodies) {
+      for (const { kind, at } of instrumentBlocks(b, blocks.length)) blocks.push({ kind, fn, ...loc(at) });
+    }
+  }
+
+  const usedHelpers = new Set([...entries, ...linked].flatMap(e => [...e.usedHelpers]));
+  const printedLinked = linked.map(printFunction);
+  const printedHelpers = entries.map(e => e.outlined.map(printFunction));
+  const helpers = Object.keys(MEM_HELPERS).filter(h => usedHelpers.has(h)).map(h => MEM_HELPERS[h].src + '\n\n').join('') +
+    [...printedLinked, ...printedHelpers.flat()].map(h => h.src + '\n\n').join('');
+
+  // Data segments: read-only tables, and the words code reaches through mem.
+  // Segment placement does not depend on the body, so entry points agree.
+  const tables = new Map(entries.flatMap(e => e.data.tables.map(t => [t.name, t])));
+  const rodata = entries.find(e => e.data.rodata)?.data.rodata ?? null;
+  const dataDecls = [...tables.values()].map(t => `const ${t.name} = array<u32, ${t.words.length}>(${formatWords(t.words)});\n`).join('') +
+    (rodata ? '@group(0) @binding(3) var<storage, read> rodata: array<u32>;\n' : '');
+  for (const c of entries.flatMap(e => e.data.copies)) {
+    if (c.to + c.count > MEM_WORDS) console.warn(`Transpiler: data segment at ${c.to * 4} does not fit in mem`);
+  }
+
+  const [resW, resH] = specialize ? [RES_OVERRIDES.l3, RES_OVERRIDES.l4] : ['uniforms.width', 'uniforms.height'];
+  const overrideDecls = specialize ? `
+// Canvas size, fixed per pipeline
+override ${resW}: f32;
+override ${resH}: f32;
+` : '';
+
+  // Instrumented builds: block counts (counters[1 + k]), the largest per-pixel
+  // loop iteration count (counters[0]) and the per-pixel counts (heat)
+  const counterDecls = instrument ? `
+// Execution counters (instrumented build)
+var<private> bb: array<u32, ${Math.max(blocks.length, 1)}>;
+var<private> steps: u32;
+@group(0) @binding(4) var<storage, read_write> heat: array<u32>;
+@group(0) @binding(5) var<storage, read_write> counters: array<atomic<u32>>;
+` : '';
+  const counterFlush = instrument ? `
+  // Per-pixel loop iterations, and this invocation's block counts
+  heat[${supersample ? '(gid.z * H + py)' : 'py'} * W + px] = steps;
+  atomicMax(&counters[0], steps);
+  for (var i = 0u; i < ${blocks.length}u; i++) { if bb[i] != 0u { atomicAdd(&counters[i + 1u], bb[i]); } }
+` : '';
+
+  // Persistent workgroups: the next tile to shade, and the tile a workgroup drew
+  const queueDecl = persistent ? `
+// Work queue (persistent workgroups)
+@group(0) @binding(6) var<storage, read_write> queue: atomic<u32>;
+var<workgroup> tile: u32;
+` : '';
+  // An invocation shades many pixels: their counts start from zero
+  const counterReset = instrument && persistent ? `
+  steps = 0u;
+  bb = array<u32, ${Math.max(blocks.length, 1)}>();
+` : '';
+
+  const fields = entries.flatMap(e => e.prologue?.fields ?? []);
+  const frameDecl = fields.length ? `
+// Values that depend only on the uniforms, written once per frame by prologue()
+struct Frame {
+${fields.map(f => `  ${f.name}: ${f.type},`).join('\n')}
+}
+@group(0) @binding(2) var<storage, read_write> frame: Frame;
+` : '';
+
+  // One prologue (when it has one) and main function per entry point
+  const regions = [];
+  const entryFns = entries.map((e, k) => {
+    const { ir, type, globalInfo, prologue, locate } = e;
+    const { lines: bodyLines, offsets: bodyOffsets, needsCfFlags } = printBody(ir);
+
+    // Declare global variables that are used
+    const globalDecls = [...globalInfo].map(([name, g]) => `  var ${name}: ${g.type} = ${g.init};`).join('\n');
+
+    // Parameters of the image function; body locals are scoped by scopeLocals()
+    const localDecls = type.params.map((t, i) => `  var l${i}: ${wgslType(t)} = ${formatLit(wgslType(t), 0)};`).join('\n');
+
+    // Control flow flag variables (for multi-level br propagation)
+    const cfDecls = needsCfFlags
+      ? '  var cf_exit: u32 = 0u;\n  var cf_cont: u32 = 0u;\n'
+      : '';
+
+    const dataInit = e.data.copies.map(c =>
+      `  for (var i = 0u; i < ${Math.min(c.count, MEM_WORDS - c.to)}u; i++) { mem[${c.to}u + i] = ${c.src}[${c.from}u + i]; }\n`).join('');
+
+    let prologueFn = '';
+    if (prologue) {
+      const init = name => FRAME_PARAMS[name] ?? globalInfo.get(name).init;
+      const printed = printBody(prologue.body);
+      const lines = [
+        ...prologue.inputs.map(n => `let ${n}: ${e.frameInputs.get(n)} = ${init(n)};`),
+        ...printed.lines,
+      ];
+      regions.push([`fn ${e.prologueName}() {`, [null, ...prologue.inputs.map(() => null), ...printed.offsets], locate]);
+      prologueFn = `@compute @workgroup_size(1)
+fn ${e.prologueName}() {
+${indent(lines)}
+}
+
+`;
+    }
+    // Source map: the body starts at the marker after the function's head
+    const shade = persistent || fragment ? e.main.replace(/^(main|fs)/, 'shade') : e.main;
+    regions.push(['// --- transpiled WASM bytecode', [null, ...bodyOffsets], locate, `fn ${shade}(`]);
+    e.outlined.forEach((h, i) => regions.push([`fn ${h.name}(`, printedHelpers[k][i].offsets, locate]));
+
+    const queueLoop = persistent ? `@compute @workgroup_size(8, 8)
+fn ${e.main}(@builtin(local_invocation_id) lid: vec3<u32>, @builtin(local_invocation_index) lix: u32) {
+  let W = u32(${resW});
+  let H = u32(${resH});
+  let tilesX = (W + 7u) / 8u;
+  let layer = tilesX * ((H + 7u) / 8u);
+  let tiles = layer${supersample ? ' * max(uniforms.samples, 1u)' : ''};
+  loop {
+    if lix == 0u { tile = atomicAdd(&queue, 1u); }
+    let t = workgroupUniformLoad(&tile);
+    if t >= tiles { break; }
+    let xy = t % layer;
+    ${shade}(vec3((xy % tilesX) * 8u + lid.x, (xy / tilesX) * 8u + lid.y, t / layer));
+    // Everyone has read \`tile\` before it is overwritten
+    workgroupBarrier();
+  }
+}
+
+` : '';
+    // Fragment target: shade() leaves the colour in mem[0..3]
+    const fragmentFn = fragment ? `@fragment
+fn ${e.main}(@builtin(position) pos: vec4<f32>) -> @location(0) vec4<f32> {
+  ${shade}(vec3(u32(pos.x), u32(pos.y), 0u));
+  return vec4(bitcast<f32>(mem[0]), bitcast<f32>(mem[1]), bitcast<f32>(mem[2]), 1.0);
+}
+` : '';
+
+    return `${prologueFn}${shade !== e.main ? `fn ${shade}(gid: vec3<u32>) {` : `@compute @workgroup_size(8, 8)
+fn ${e.main}(@builtin(global_invocation_id) gid: vec3<u32>) {`}
   let px = gid.x;
   let py = gid.y;
-  let W = u32(uniforms.width);
-  let H = u32(uniforms.height);
+  let W = u32(${resW});
+  let H = u32(${resH});
   if (px >= W || py >= H) { return; }
-
-  var mem: array<u32, 4096>;
-
+${counterReset}
   // Global variables (WASM globals, e.g., stack pointer)
 ${globalDecls}
 
-  // Local variables (from WASM function signature + body)
+  // ${e.name} parameters (body locals are declared where they are used)
 ${localDecls}
-${cfDecls}
-  // Initialize mainImage parameters
+${cfDecls}${dataInit ? `\n  // Data segments that code can reach through mem\n${dataInit}` : ''}
+${supersample ? `  // Sample gid.z: where in the pixel fragCoord lies
+  let jitter = ${SAMPLE_JITTER};
+
+` : ''}  // Initialize ${e.name} parameters
   l0 = 0u;                     // output pointer
-  l1 = f32(px) + 0.5;         // fragCoordX
-  l2 = uniforms.height - f32(py) - 0.5;  // fragCoordY (flip Y)
-  l3 = uniforms.width;        // iResolutionX
-  l4 = uniforms.height;       // iResolutionY
+  l1 = f32(px) + ${supersample ? 'jitter.x' : '0.5'};         // fragCoordX
+  l2 = ${resH} - f32(py) - ${supersample ? 'jitter.y' : '0.5'};  // fragCoordY (flip Y)
+  l3 = ${resW};        // iResolutionX
+  l4 = ${resH};       // iResolutionY
   l5 = uniforms.time;         // iTime
 
   // --- transpiled WASM bytecode (native WGSL, no interpreter) ---
-${body}
-
+${indent(bodyLines)}
+${fragment ? '' : `
   // Write output from mem[0..3]
-  let oidx = (py * W + px) * 4u;
+  let oidx = (${supersample ? '(gid.z * H + py)' : 'py'} * W + px) * 4u;
   output[oidx]      = bitcast<f32>(mem[0]);
   output[oidx + 1u] = bitcast<f32>(mem[1]);
   output[oidx + 2u] = bitcast<f32>(mem[2]);
   output[oidx + 3u] = bitcast<f32>(mem[3]);
+`}${counterFlush}}
+${queueLoop || fragmentFn ? `
+${(queueLoop || fragmentFn).trimEnd()}
+` : ''}`;
+  });
+  linked.forEach((f, i) => regions.push([`fn ${f.name}(`, printedLinked[i].offsets, f.locate]));
+
+  const code = `struct Uniforms {
+  time: f32,
+  width: f32,
+  height: f32,
+  samples: u32,
 }
-`;
+
+${fragment ? '' : `@group(0) @binding(0) var<storage, read_write> output: array<f32>;
+`}@group(0) @binding(1) var<uniform> uniforms: Uniforms;
+${overrideDecls}${frameDecl}
+// WASM linear memory (per invocation)
+var<private> mem: array<u32, ${MEM_WORDS}>;
+${dataDecls ? `\n// WASM data segments\n${dataDecls}` : ''}${counterDecls}${queueDecl}
+${helpers}${entryFns.join('\n')}${fragment ? FULLSCREEN_VS : ''}`;
+
+  // Source map: the instruction each line of a printed body came from, found
+  // in `code` by the line its region starts at (the first after `after`)
+  const codeLines = code.split('\n');
+  const sourceMap = codeLines.map(() => null);
+  for (const [marker, offsets, loc, after] of regions) {
+    const from = after ? codeLines.findIndex(l => l.startsWith(after)) : 0;
+    const start = codeLines.findIndex((l, i) => i >= from && l.trimStart().startsWith(marker));
+    offsets.forEach((at, i) => { if (at !== null) sourceMap[start + i] = loc(at); });
+  }
+
+  // frameSize: bytes of the Frame buffer at binding 2, 0 when no entry point has a prologue
+  // timeDependent: false when the image does not change with iTime
+  // specialized: pipelines must set the RES_W / RES_H overrides
+  // supersampled: built with options.supersample
+  // persistent: built with options.persistent
+  // target: 'compute', or 'fragment' (generateFragmentShader)
+  // rodata: contents of the read-only storage buffer at binding 3, or null
+  // report: static cost of one invocation of main (see passes/cost.js)
+  // entryPoints: [{ name (export), main, prologue (WGSL entry point names;
+  //   prologue null when there is none), timeDependent, report }], one per
+  //   options.entryPoints; the fields above describe the first
+  // blocks: with options.instrument, the counted blocks; counters[1 + k] is
+  //   blocks[k] = { kind, fn (WGSL function), offset, func, file, line, column }
+  //   (see sourceMap); null otherwise
+  // sourceMap[i]: where line i + 1 of `code` came from, or null —
+  //   { offset: byte offset of the instruction in its module, func: function name,
+  //     file, line, column: C++ position from .debug_line, null without it }
+  return {
+    code, frameSize: fields.length ? structSize(fields.map(f => f.type)) : 0,
+    timeDependent: entries[0].timeDependent, specialized: specialize, supersampled: supersample, persistent, target, rodata, report: entries[0].report,
+    entryPoints: entries.map(e => ({ name: e.name, main: e.main, prologue: e.prologueName, timeDependent: e.timeDependent, report: e.report })),
+    sourceMap, blocks,
+  };
 }
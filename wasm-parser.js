@@ -1,20 +1,53 @@
 // =============================================================================
-// WASM Binary Parser — extracts types, imports, globals, exports, and code
+// WASM Binary Parser — extracts types, imports, globals, exports, code, data,
+// function names (name section) and the DWARF line table (.debug_line)
 // =============================================================================
 
+// 32-bit FNV-1a hash, which identifies a function body (see profile.mjs)
+export function fnv1a(bytes) {
+  let h = 0x811c9dc5;
+  for (const b of bytes) h = Math.imul(h ^ b, 0x01000193) >>> 0;
+  return h;
+}
+
+const utf8 = new TextDecoder();
+
+// Resolves the function imports of each parsed module against the exports of
+// the others, by name (the import's module name is not consulted; the first
+// module exporting the name wins). Sets R.links on every module: a Map from
+// an imported function index to { wasm, index } — the exporting module and
+// the function's index there. Returns the modules.
+export function linkModules(modules) {
+  const exporters = new Map(); // name → { wasm, index }
+  for (const wasm of modules) {
+    for (const e of wasm.exports) {
+      if (e.kind === 0 && !exporters.has(e.name)) exporters.set(e.name, { wasm, index: e.index });
+    }
+  }
+  for (const wasm of modules) {
+    wasm.links = new Map();
+    wasm.imports.filter(i => i.kind === 0).forEach((im, index) => {
+      const target = exporters.get(im.name);
+      if (target && target.wasm !== wasm) wasm.links.set(index, target);
+    });
+  }
+  return modules;
+}
+
 export class WasmParser {
+  // buffer: an ArrayBuffer, or a typed array view of the module
   constructor(buffer) {
-    this.buf = new Uint8Array(buffer);
+    this.buf = ArrayBuffer.isView(buffer) ? new Uint8Array(buffer.buffer, buffer.byteOffset, buffer.byteLength) : new Uint8Array(buffer);
+    this.view = new DataView(this.buf.buffer, this.buf.byteOffset, this.buf.byteLength);
     this.pos = 0;
   }
 
   u8() { return this.buf[this.pos++]; }
 
   u32() {
-    const v = this.buf[this.pos] | (this.buf[this.pos+1]<<8) |
-              (this.buf[this.pos+2]<<16) | (this.buf[this.pos+3]<<24);
+    const v = this.view.getUint32(this.pos, true);
     this.pos += 4;
-    return v >>> 0;
+    return v;
   }
 
   uleb() {
@@ -34,28 +67,51 @@ export class WasmParser {
     return r;
   }
 
-  bytes(n) { const s = this.buf.slice(this.pos, this.pos + n); this.pos += n; return s; }
-  str() { const n = this.uleb(); return new TextDecoder().decode(this.bytes(n)); }
+  // A view into the module, not a copy
+  bytes(n) { const s = this.buf.subarray(this.pos, this.pos + n); this.pos += n; return s; }
+  str() { const n = this.uleb(); return utf8.decode(this.bytes(n)); }
+  // NUL-terminated string (DWARF)
+  cstr() { const end = this.buf.indexOf(0, this.pos); const s = utf8.decode(this.buf.subarray(this.pos, end)); this.pos = end + 1; return s; }
+  u16() { const v = this.view.getUint16(this.pos, true); this.pos += 2; return v; }
 
-  parse() {
+  // Parses several modules and links them (see linkModules): the first with
+  // `options`, the others — libraries — with every body decoded.
+  static parseAll(buffers, options = {}) {
+    return linkModules(buffers.map((b, i) => new WasmParser(b).parse(i === 0 ? options : {})));
+  }
+
+  // options.roots: export names. When given, function bodies are only
+  // decoded if a chain of direct calls reaches them from a root; the others
+  // keep just their location ({ start, end }), and R.reachable lists the
+  // decoded function indices.
+  parse(options = {}) {
     const magic = this.u32();
     const version = this.u32();
-    const R = { types: [], imports: [], functions: [], globals: [], exports: [], codes: [] };
+    const R = { types: [], imports: [], functions: [], globals: [], exports: [], codes: [], data: [] };
+    const custom = {}; // custom section name → { start, end } of its payload
 
     while (this.pos < this.buf.length) {
       const id = this.u8();
       const size = this.uleb();
       const end = this.pos + size;
       switch (id) {
+        case 0: { const name = this.str(); custom[name] = { start: this.pos, end }; break; }
         case 1: this.#types(R); break;
         case 2: this.#imports(R); break;
         case 3: this.#functions(R); break;
         case 6: this.#globals(R); break;
         case 7: this.#exports(R); break;
-        case 10: this.#code(R); break;
+        case 10: R.codeStart = this.pos; this.#code(R); break;
+        case 11: this.#data(R); break;
+        case 12: R.dataCount = this.uleb(); break;
       }
       this.pos = end;
     }
+    const decode = options.roots ? this.#reachable(R, options.roots) : R.codes.map((_, i) => i);
+    for (const i of decode) this.#decode(R.codes[i]);
+    if (options.roots) R.reachable = decode.map(i => i + R.imports.filter(im => im.kind === 0).length);
+    if (custom.name) this.#names(R, custom.name);
+    if (custom['.debug_line']) R.lineTable = this.#lineTable(custom['.debug_line'], custom['.debug_line_str']);
     return R;
   }
 
@@ -108,22 +164,256 @@ export class WasmParser {
     }
   }
 
+  // Function bodies are only located here; #decode() reads them.
   #code(R) {
     const n = this.uleb();
     for (let i = 0; i < n; i++) {
-      const bodySize = this.uleb(), bodyEnd = this.pos + bodySize;
-      const ldCount = this.uleb();
-      let extraLocals = 0;
-      const localTypes = [];
-      for (let j = 0; j < ldCount; j++) {
-        const count = this.uleb();
-        const type = this.u8();
-        for (let k = 0; k < count; k++) localTypes.push(type);
-        extraLocals += count;
+      const bodySize = this.uleb();
+      R.codes.push({ start: this.pos, end: this.pos + bodySize });
+      this.pos += bodySize;
+    }
+  }
+
+  // Locals and bytecode of a located body (the bytecode is a view, not a copy)
+  #decode(c) {
+    this.pos = c.start;
+    const ldCount = this.uleb();
+    let extraLocals = 0;
+    const localTypes = [];
+    for (let j = 0; j < ldCount; j++) {
+      const count = this.uleb();
+      const type = this.u8();
+      for (let k = 0; k < count; k++) localTypes.push(type);
+      extraLocals += count;
+    }
+    c.extraLocals = extraLocals;
+    c.localTypes = localTypes;
+    c.bodyStart = this.pos; // module offset of bodyBytes[0]
+    c.bodyBytes = this.buf.subarray(this.pos, c.end);
+  }
+
+  // Code indices reachable from the exported functions `roots` via `call`.
+  // A body with call_indirect, or with an instruction this scan does not
+  // know, could call anything, so then every body is reachable.
+  #reachable(R, roots) {
+    const numImports = R.imports.filter(i => i.kind === 0).length;
+    const seen = new Set();
+    const work = R.exports.filter(e => e.kind === 0 && roots.includes(e.name)).map(e => e.index - numImports);
+    while (work.length) {
+      const i = work.pop();
+      if (i < 0 || seen.has(i)) continue;
+      seen.add(i);
+      if (seen.size === R.codes.length) break;
+      const callees = this.#callees(R.codes[i]);
+      if (!callees) return R.codes.map((_, j) => j);
+      for (const f of callees) work.push(f - numImports);
+    }
+    return [...seen].sort((a, b) => a - b);
+  }
+
+  // Function indices called directly by a located body, or null
+  #callees(c) {
+    const out = new Set();
+    for (const ins of this.instructions(c)) {
+      if (ins.op === null || ins.op === 0x11) return null; // unknown, call_indirect
+      if (ins.op === 0x10) out.add(ins.index);
+    }
+    return out;
+  }
+
+  // Walks the instructions of a located body (R.codes[i]), yielding
+  // { op, at, end, index }: module offsets of the opcode and of the next
+  // instruction, and the function index of a call. An opcode whose
+  // immediates are unknown yields op null and ends the walk. The parser's
+  // position is shared, so finish with one body before parsing anything else.
+  *instructions(c) {
+    this.pos = c.start;
+    const ldCount = this.uleb();
+    for (let j = 0; j < ldCount; j++) { this.uleb(); this.u8(); }
+    const skip = () => { while (this.u8() & 0x80); }; // any LEB128
+    while (this.pos < c.end) {
+      const at = this.pos;
+      const op = this.u8();
+      let index = null;
+      if (op === 0x10) index = this.uleb();
+      else if (op === 0x11) { skip(); skip(); } // call_indirect
+      else if (op === 0x02 || op === 0x03 || op === 0x04) skip(); // block type
+      else if (op === 0x0c || op === 0x0d || (op >= 0x20 && op <= 0x26) || op === 0xd2) skip();
+      else if (op === 0x0e) { const n = this.uleb(); for (let k = 0; k <= n; k++) skip(); }
+      else if (op === 0x1c) { const n = this.uleb(); this.pos += n; }
+      else if (op >= 0x28 && op <= 0x3e) { skip(); skip(); } // memarg
+      else if (op === 0x3f || op === 0x40 || op === 0xd0) this.u8();
+      else if (op === 0x41 || op === 0x42) skip();
+      else if (op === 0x43) this.pos += 4;
+      else if (op === 0x44) this.pos += 8;
+      else if (op === 0xfc) {
+        const sub = this.uleb();
+        if (sub === 8) { skip(); this.u8(); } // memory.init
+        else if (sub === 10) this.pos += 2; // memory.copy
+        else if (sub === 11) this.u8(); // memory.fill
+        else if (sub === 12 || sub === 14) { skip(); skip(); }
+        else if (sub === 9 || sub === 13 || (sub >= 15 && sub <= 17)) skip();
+        else if (sub > 7) { yield { op: null, at, end: this.pos, index }; return; }
+      } else if (!(op <= 0x01 || op === 0x05 || op === 0x0b || op === 0x0f || op === 0x1a || op === 0x1b ||
+                   (op >= 0x45 && op <= 0xc4) || op === 0xd1)) {
+        yield { op: null, at, end: this.pos, index };
+        return;
+      }
+      yield { op, at, end: this.pos, index };
+    }
+  }
+
+  // Active segments carry their byte offset in memory 0; passive ones
+  // (memory.init sources) and relocatable ones (global.get offset) have
+  // offset null.
+  #data(R) {
+    const n = this.uleb();
+    for (let i = 0; i < n; i++) {
+      const flags = this.uleb();
+      let offset = null;
+      if (!(flags & 1)) {
+        if (flags & 2) this.uleb(); // memory index
+        const initOp = this.u8();
+        const v = initOp === 0x41 ? this.sleb() : this.uleb();
+        if (initOp === 0x41) offset = v >>> 0;
+        this.u8(); // end
+      }
+      const bytes = this.bytes(this.uleb());
+      R.data.push({ offset, bytes });
+    }
+  }
+
+  // R.names: { module, functions: Map index → name, locals: Map function
+  // index → Map local index → name }
+  #names(R, { start, end }) {
+    const names = { module: null, functions: new Map(), locals: new Map() };
+    this.pos = start;
+    while (this.pos < end) {
+      const id = this.u8();
+      const subEnd = this.uleb() + this.pos;
+      if (id === 0) names.module = this.str();
+      else if (id === 1) {
+        const n = this.uleb();
+        for (let i = 0; i < n; i++) { const idx = this.uleb(); names.functions.set(idx, this.str()); }
+      } else if (id === 2) {
+        const n = this.uleb();
+        for (let i = 0; i < n; i++) {
+          const f = this.uleb(), locals = new Map(), m = this.uleb();
+          for (let j = 0; j < m; j++) { const idx = this.uleb(); locals.set(idx, this.str()); }
+          names.locals.set(f, locals);
+        }
+      }
+      this.pos = subEnd;
+    }
+    R.names = names;
+  }
+
+  // Runs the DWARF (v2-v5, 32-bit) line number programs of .debug_line.
+  // Returns rows { address, file, line, column, end } sorted by address;
+  // addresses are offsets into the code section payload (R.codeStart), and
+  // an `end` row closes a sequence.
+  #lineTable({ start, end }, lineStr) {
+    const rows = [];
+    this.pos = start;
+    while (this.pos < end) {
+      const unitLength = this.u32();
+      if (unitLength === 0xffffffff) break; // 64-bit DWARF
+      const unitEnd = this.pos + unitLength;
+      const version = this.u16();
+      if (version >= 5) this.pos += 2; // address_size, segment_selector_size
+      const headerLength = this.u32();
+      const program = this.pos + headerLength;
+      const minInst = this.u8();
+      if (version >= 4) this.u8(); // maximum_operations_per_instruction
+      this.u8(); // default_is_stmt
+      const lineBase = (this.u8() << 24) >> 24;
+      const lineRange = this.u8();
+      const opcodeBase = this.u8();
+      const argCounts = [0];
+      for (let i = 1; i < opcodeBase; i++) argCounts.push(this.u8());
+
+      let files;
+      const join = (dir, path) => (!dir || path.startsWith('/') ? path : `${dir}/${path}`);
+      if (version < 5) {
+        const dirs = [''];
+        for (let d; (d = this.cstr());) dirs.push(d);
+        files = [null]; // 1-based
+        for (let f; (f = this.cstr());) { const dir = this.uleb(); this.uleb(); this.uleb(); files.push(join(dirs[dir], f)); }
+      } else {
+        // Entry formats: (content type, form) pairs; 1 = path, 2 = directory index
+        const entries = () => {
+          const formats = [];
+          for (let n = this.u8(); n > 0; n--) formats.push([this.uleb(), this.uleb()]);
+          const out = [];
+          for (let n = this.uleb(); n > 0; n--) {
+            const e = {};
+            for (const [type, form] of formats) {
+              const v = this.#form(form, lineStr);
+              if (type === 1) e.path = v;
+              if (type === 2) e.dir = v;
+            }
+            out.push(e);
+          }
+          return out;
+        };
+        const dirs = entries().map(e => e.path);
+        files = entries().map(e => join(dirs[e.dir ?? 0], e.path)); // 0-based
+      }
+
+      this.pos = program;
+      let address = 0, file = 1, line = 1, column = 0;
+      const row = (isEnd = false) => rows.push({ address, file: files[file] ?? null, line, column, end: isEnd });
+      while (this.pos < unitEnd) {
+        const op = this.u8();
+        if (op >= opcodeBase) {
+          const adj = op - opcodeBase;
+          address += Math.floor(adj / lineRange) * minInst;
+          line += lineBase + (adj % lineRange);
+          row();
+        } else if (op === 0) { // extended
+          const len = this.uleb();
+          const next = this.pos + len;
+          const sub = this.u8();
+          if (sub === 1) { row(true); address = 0; file = 1; line = 1; column = 0; }
+          else if (sub === 2) address = this.u32();
+          this.pos = next;
+        } else if (op === 1) row();
+        else if (op === 2) address += this.uleb() * minInst;
+        else if (op === 3) line += this.sleb();
+        else if (op === 4) file = this.uleb();
+        else if (op === 5) column = this.uleb();
+        else if (op === 8) address += Math.floor((255 - opcodeBase) / lineRange) * minInst;
+        else if (op === 9) address += this.u16();
+        else for (let i = 0; i < argCounts[op]; i++) this.uleb();
+      }
+      this.pos = unitEnd;
+    }
+    // Stable: an end row sorts before a row that starts at the same address
+    return rows.map((r, i) => [r, i]).sort((a, b) => a[0].address - b[0].address || b[0].end - a[0].end || a[1] - b[1]).map(([r]) => r);
+  }
+
+  // Value of a DWARF attribute form in a v5 line table header
+  #form(form, lineStr) {
+    switch (form) {
+      case 0x08: return this.cstr(); // string
+      case 0x1f: { // line_strp
+        const off = this.u32();
+        if (!lineStr) return null;
+        const at = this.pos;
+        this.pos = lineStr.start + off;
+        const s = this.cstr();
+        this.pos = at;
+        return s;
       }
-      const bodyBytes = this.buf.slice(this.pos, bodyEnd);
-      R.codes.push({ extraLocals, localTypes, bodyBytes });
-      this.pos = bodyEnd;
+      case 0x0e: this.u32(); return null; // strp (.debug_str is not read)
+      case 0x0b: return this.u8(); // data1
+      case 0x05: return this.u16(); // data2
+      case 0x06: return this.u32(); // data4
+      case 0x07: this.pos += 8; return null; // data8
+      case 0x0f: return this.uleb(); // udata
+      case 0x1e: this.pos += 16; return null; // data16 (MD5)
+      case 0x09: this.pos += this.uleb(); return null; // block
+      default: throw new Error(`WasmParser: unsupported DWARF form 0x${form.toString(16)}`);
     }
   }
 }
@@ -0,0 +1,304 @@
+// =============================================================================
+// Structured IR for the transpiler — built from WASM bytecode, rewritten by
+// optimization passes, then lowered to WGSL text by printBody().
+// =============================================================================
+
+// ---- expressions ----
+//   { k: 'ref',  name, type }             named value (tN, lN, gN, ...)
+//   { k: 'lit',  type, v }                scalar literal
+//   { k: 'op',   op, a, b, type }         infix binary operator
+//   { k: 'un',   op, a, type }            prefix unary operator
+//   { k: 'call', fn, args, type, mem? }   built-in / constructor / bitcast<T>, or
+//                                         a linked function; mem: it may read
+//                                         or write mem, so it stays in place
+//   { k: 'mem',  idx, type, arr? }        mem[idx], or arr[idx] for a read-only table
+//   { k: 'lane', a, lane, type }          vector component (a.x)
+
+export const ref = (name, type) => ({ k: 'ref', name, type });
+export const lit = (type, v) => ({ k: 'lit', type, v });
+export const op = (o, a, b, type) => ({ k: 'op', op: o, a, b, type });
+export const un = (o, a, type) => ({ k: 'un', op: o, a, type });
+export const call = (fn, args, type) => ({ k: 'call', fn, args, type });
+export const mem = (idx, arr) => (arr ? { k: 'mem', idx, type: 'u32', arr } : { k: 'mem', idx, type: 'u32' });
+export const lane = (a, l, type) => ({ k: 'lane', a, lane: l, type });
+
+export function bitcast(type, e) {
+  if (e.type === type) return e;
+  return call(`bitcast<${type}>`, [e], type);
+}
+
+// ---- statements ----
+//   { k: 'let',   name, type, e, note? }         note: trailing comment
+//   { k: 'var',   name, type, init }              init: null when never read before written
+//   { k: 'set',   name, e }                       var assignment
+//   { k: 'store', idx, e, arr? }                  mem[idx] = e, or arr[idx] = e
+//   { k: 'expr',  e }                             call statement
+//   { k: 'block', kind: 'block'|'loop', label, body, counted? }
+//                 counted: { name, init, cond, next } — a loop printed as
+//                 `for (name = init; cond; name = next)`; init may be null
+//   { k: 'if',    label, cond, then, els }        els: null when no else arm
+//   { k: 'br',    label, cond }                   cond: null for unconditional br
+//   { k: 'switch', sel, targets, def }            br_table: br targets[sel], or def when out of range
+//   { k: 'return', e? }                           e: the result of a function that has one
+// Any statement may carry `at`: the bytecode offset (in the function body)
+// of the instruction it was transpiled from.
+
+export function formatF32(val) {
+  if (Object.is(val, -0)) return '-0.0';
+  if (val === Infinity) return '3.40282346638528859812e+38';   // f32 max
+  if (val === -Infinity) return '-3.40282346638528859812e+38'; // f32 min
+  if (Number.isNaN(val)) return '0.0';                         // NaN → 0
+  const s = val.toString();
+  if (s.includes('.') || s.includes('e') || s.includes('E')) return s;
+  return s + '.0';
+}
+
+export function formatLit(type, v) {
+  if (type === 'f32') return formatF32(v);
+  // -2147483648i negates 2147483648i, which is out of range
+  if (type === 'i32') return (v | 0) === -0x80000000 ? 'i32(-2147483648)' : `${v | 0}i`;
+  if (type === 'bool') return v ? 'true' : 'false';
+  return `${v >>> 0}u`;
+}
+
+const LANES = 'xyzw';
+
+export function printExpr(e) {
+  switch (e.k) {
+    case 'ref': return e.name;
+    case 'lit': return formatLit(e.type, e.v);
+    case 'op': return `${printOperand(e.a)} ${e.op} ${printOperand(e.b)}`;
+    case 'un': return `${e.op}(${printExpr(e.a)})`;
+    case 'call': return `${e.fn}(${e.args.map(printExpr).join(', ')})`;
+    case 'mem': return `${e.arr ?? 'mem'}[${printExpr(e.idx)}]`;
+    case 'lane': return `${printOperand(e.a)}.${LANES[e.lane]}`;
+  }
+  throw new Error(`printExpr: unknown node ${e.k}`);
+}
+
+// Nested infix operators are always parenthesized: WGSL forbids mixing
+// several of them (e.g. `a & b | c`) without explicit grouping.
+function printOperand(e) {
+  return e.k === 'op' ? `(${printExpr(e)})` : printExpr(e);
+}
+
+// ---- traversal ----
+
+export function forEachExpr(e, fn) {
+  fn(e);
+  switch (e.k) {
+    case 'op': forEachExpr(e.a, fn); forEachExpr(e.b, fn); break;
+    case 'un': case 'lane': forEachExpr(e.a, fn); break;
+    case 'call': for (let i = 0; i < e.args.length; i++) forEachExpr(e.args[i], fn); break;
+    case 'mem': forEachExpr(e.idx, fn); break;
+  }
+}
+
+// Whether `e` calls a function that may read or write mem (a `mem` call)
+export function callsMem(e) {
+  let found = false;
+  forEachExpr(e, n => { if (n.k === 'call' && n.mem) found = true; });
+  return found;
+}
+
+// Rebuilds `e` bottom-up, replacing each node by fn(node) (or keeping it when
+// fn returns undefined). A node is copied only when one of its operands
+// changed, so unchanged subtrees are shared with `e`.
+export function mapExpr(e, fn) {
+  let n = e;
+  switch (e.k) {
+    case 'op': {
+      const a = mapExpr(e.a, fn), b = mapExpr(e.b, fn);
+      if (a !== e.a || b !== e.b) n = { ...e, a, b };
+      break;
+    }
+    case 'un': case 'lane': {
+      const a = mapExpr(e.a, fn);
+      if (a !== e.a) n = { ...e, a };
+      break;
+    }
+    case 'call': {
+      const args = e.args.map(a => mapExpr(a, fn));
+      if (args.some((a, i) => a !== e.args[i])) n = { ...e, args };
+      break;
+    }
+    case 'mem': {
+      const idx = mapExpr(e.idx, fn);
+      if (idx !== e.idx) n = { ...e, idx };
+      break;
+    }
+  }
+  return fn(n) ?? n;
+}
+
+// Expressions directly owned by a statement (not those of nested bodies).
+export function stmtExprs(s) {
+  switch (s.k) {
+    case 'let': case 'set': case 'expr': return [s.e];
+    case 'var': return s.init ? [s.init] : [];
+    case 'store': return [s.idx, s.e];
+    case 'if': return [s.cond];
+    case 'br': return s.cond ? [s.cond] : [];
+    case 'switch': return [s.sel];
+    case 'return': return s.e ? [s.e] : [];
+    case 'block': return s.counted ? countedExprs(s.counted) : [];
+  }
+  return [];
+}
+
+export function mapStmtExprs(s, fn) {
+  switch (s.k) {
+    case 'let': case 'set': case 'expr': s.e = fn(s.e); break;
+    case 'var': if (s.init) s.init = fn(s.init); break;
+    case 'store': s.idx = fn(s.idx); s.e = fn(s.e); break;
+    case 'if': s.cond = fn(s.cond); break;
+    case 'br': if (s.cond) s.cond = fn(s.cond); break;
+    case 'switch': s.sel = fn(s.sel); break;
+    case 'return': if (s.e) s.e = fn(s.e); break;
+    case 'block':
+      if (s.counted) {
+        const c = s.counted;
+        if (c.init) c.init = fn(c.init);
+        c.cond = fn(c.cond);
+        c.next = fn(c.next);
+      }
+      break;
+  }
+}
+
+function countedExprs(c) {
+  return c.init ? [c.init, c.cond, c.next] : [c.cond, c.next];
+}
+
+export function childBodies(s) {
+  if (s.k === 'block') return [s.body];
+  if (s.k === 'if') return s.els ? [s.then, s.els] : [s.then];
+  return [];
+}
+
+// Pre-order walk over every statement, including nested bodies. Hot in
+// every pass, so it visits the bodies without childBodies()' array.
+export function forEachStmt(body, fn) {
+  for (let i = 0; i < body.length; i++) {
+    const s = body[i];
+    fn(s);
+    if (s.k === 'block') forEachStmt(s.body, fn);
+    else if (s.k === 'if') {
+      forEachStmt(s.then, fn);
+      if (s.els) forEachStmt(s.els, fn);
+    }
+  }
+}
+
+// ---- lowering to WGSL text ----
+//
+// WASM blocks, loops and ifs become `loop { ... }` wrappers so that `br N`
+// can be expressed with break/continue. Branches that leave more than one
+// level set cf_exit/cf_cont, and every enclosing block re-dispatches on them.
+
+// offsets[i]: bytecode offset of the statement that printed lines[i] (its
+// `at`), or null for statements the passes made up
+export function printBody(body) {
+  const ctx = { lines: [], offsets: [], labels: [], needsCfFlags: false };
+  printStmts(body, ctx);
+  return { lines: ctx.lines, offsets: ctx.offsets, needsCfFlags: ctx.needsCfFlags };
+}
+
+function condExpr(e) {
+  return e.type === 'bool' ? printExpr(e) : `${printExpr(bitcast('u32', e))} != 0u`;
+}
+
+function printStmts(body, ctx) {
+  const { lines, offsets } = ctx;
+  for (const s of body) {
+    const first = lines.length;
+    switch (s.k) {
+      case 'let': lines.push(`let ${s.name}: ${s.type} = ${printExpr(s.e)};${s.note ? ` // ${s.note}` : ''}`); break;
+      case 'var': lines.push(`var ${s.name}: ${s.type}${s.init ? ` = ${printExpr(s.init)}` : ''};`); break;
+      case 'set': lines.push(`${s.name} = ${printExpr(s.e)};`); break;
+      case 'store': lines.push(`${s.arr ?? 'mem'}[${printExpr(s.idx)}] = ${printExpr(s.e)};`); break;
+      case 'expr': lines.push(`${printExpr(s.e)};`); break;
+      case 'return': lines.push(s.e ? `return ${printExpr(s.e)};` : `return;`); break;
+      case 'block': {
+        const c = s.counted;
+        if (c) {
+          const init = c.init ? `${c.name} = ${printExpr(c.init)}` : '';
+          lines.push(`for (${init}; ${printExpr(c.cond)}; ${c.name} = ${printExpr(c.next)}) { // ${s.label}`);
+        } else {
+          lines.push(`loop { // ${s.label}`);
+        }
+        ctx.labels.push(s);
+        printStmts(s.body, ctx);
+        ctx.labels.pop();
+        if (!c) lines.push(`break; // end ${s.label}`);
+        lines.push(`}`);
+        printCfCheck(ctx);
+        break;
+      }
+      case 'if': {
+        lines.push(`loop { // ${s.label}`);
+        lines.push(`if ${condExpr(s.cond)} {`);
+        ctx.labels.push(s);
+        printStmts(s.then, ctx);
+        if (s.els) {
+          lines.push(`} else {`);
+          printStmts(s.els, ctx);
+        }
+        ctx.labels.pop();
+        lines.push(`}`);
+        lines.push(`break; // end ${s.label}`);
+        lines.push(`}`);
+        printCfCheck(ctx);
+        break;
+      }
+      case 'br': {
+        const jump = printJump(s.label, ctx, 0);
+        lines.push(s.cond ? `if ${condExpr(s.cond)} { ${jump} }` : jump);
+        break;
+      }
+      case 'switch': {
+        // Selector values sharing a target share a case clause.
+        const cases = new Map();
+        s.targets.forEach((label, v) => {
+          if (!cases.has(label)) cases.set(label, []);
+          cases.get(label).push(`${v}u`);
+        });
+        if (!cases.has(s.def)) cases.set(s.def, []);
+        cases.get(s.def).push('default');
+        lines.push(`switch ${printExpr(bitcast('u32', s.sel))} {`);
+        // `break` inside a switch only leaves the switch: one more level.
+        for (const [label, sels] of cases) {
+          const head = sels.length === 1 && sels[0] === 'default' ? 'default' : `case ${sels.join(', ')}`;
+          lines.push(`${head}: { ${printJump(label, ctx, 1)} }`);
+        }
+        lines.push(`}`);
+        printCfCheck(ctx);
+        break;
+      }
+      default:
+        throw new Error(`printBody: unknown statement ${s.k}`);
+    }
+    // Nested statements have filled their own lines already
+    for (let i = first; i < lines.length; i++) offsets[i] ??= s.at ?? null;
+  }
+}
+
+// `extra`: WGSL constructs between the branch and the innermost label that
+// `break` would leave first (an enclosing switch).
+function printJump(label, ctx, extra) {
+  let i = ctx.labels.length - 1;
+  while (ctx.labels[i].label !== label) i--;
+  const depth = ctx.labels.length - 1 - i;
+  const isLoop = ctx.labels[i].kind === 'loop';
+  if (depth === 0 && isLoop) return 'continue;';
+  if (depth + extra === 0) return 'break;';
+  ctx.needsCfFlags = true;
+  return `cf_exit = ${depth + extra}u; cf_cont = ${isLoop ? '1u' : '0u'}; break;`;
+}
+
+// Flag check for multi-level br propagation
+function printCfCheck(ctx) {
+  if (ctx.needsCfFlags && ctx.labels.length > 0) {
+    ctx.lines.push(`if cf_exit > 0u { cf_exit = cf_exit - 1u; if cf_exit == 0u && cf_cont == 1u { continue; } else { break; } }`);
+  }
+}
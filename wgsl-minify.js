@@ -0,0 +1,133 @@
+// =============================================================================
+// WGSL minifier — optional last stage after generateComputeShader()
+//
+// Works on the WGSL text: drops comments and whitespace, renames every
+// module-declared identifier to a short name (the most used get the
+// shortest), trims float literals, and removes parentheses around a single
+// operand. Names the host refers to — entry points and pipeline overrides —
+// are kept.
+// =============================================================================
+
+// Reserved words and predeclared types short enough to collide with a
+// generated name
+const RESERVED = new Set([
+  'as', 'do', 'fn', 'if', 'in', 'is', 'of',
+  'asm', 'for', 'get', 'let', 'mod', 'mut', 'new', 'nil', 'ptr', 'pub', 'ref', 'set', 'std', 'try', 'use', 'var',
+  'f16', 'f32', 'i32', 'u32', 'mat', 'vec',
+]);
+
+const STAGES = new Set(['compute', 'fragment', 'vertex']);
+
+// Two-character operators that must not form when tokens are joined
+const OPERATORS = new Set(['--', '++', '->', '<<', '>>', '<=', '>=', '==', '!=', '&&', '||', '+=', '-=', '*=', '/=', '%=', '&=', '|=', '^=', '//', '/*', '*/']);
+
+// Returns { code, before, after, names }: the sizes in bytes, and the
+// original → short name of each renamed identifier.
+export function minifyWGSL(src) {
+  const toks = tokenize(src);
+  const renames = compactNames(toks);
+  let code = '';
+  let prev = '';
+  for (let i = 0; i < toks.length; i++) {
+    const t = toks[i];
+    // `(x)` → `x`
+    if (t.v === '(' && redundantParens(toks, i)) { toks[i + 2].skip = true; continue; }
+    if (t.skip) continue;
+    const s = t.k === 'id' ? renames.get(t.v) ?? t.v : t.k === 'num' ? trimNumber(t.v) : t.v;
+    // A space only where the two tokens would otherwise run together
+    if ((/\w$/.test(prev) && /^\w/.test(s)) || (/[\w.]$/.test(prev) && /^\.\d/.test(s)) || OPERATORS.has(prev.slice(-1) + s[0])) code += ' ';
+    code += s;
+    prev = s;
+  }
+  const size = s => new TextEncoder().encode(s).length;
+  return { code, before: size(src), after: size(code), names: renames };
+}
+
+// Whitespace and comments, or a word (identifier / number), or punctuation
+const TOKEN = /\s+|\/\/[^\n]*|\/\*[^]*?\*\/|([A-Za-z_]\w*)|(0[xX][0-9a-fA-F]+[iuf]?|(?:\d+\.?\d*|\.\d+)(?:[eE][+-]?\d+)?[iufh]?)|([^])/y;
+
+function tokenize(src) {
+  const toks = [];
+  TOKEN.lastIndex = 0;
+  for (let m; TOKEN.lastIndex < src.length && (m = TOKEN.exec(src));) {
+    if (m[1]) toks.push({ k: 'id', v: m[1] });
+    else if (m[2]) toks.push({ k: 'num', v: m[2] });
+    else if (m[3]) {
+      const two = m[3] + src[TOKEN.lastIndex];
+      if (OPERATORS.has(two)) TOKEN.lastIndex++;
+      toks.push({ k: 'punct', v: OPERATORS.has(two) ? two : m[3] });
+    }
+  }
+  return toks;
+}
+
+// Declared names → short names, most frequent first
+function compactNames(toks) {
+  const declared = new Set();
+  const keep = new Set();
+  let attrs = []; // attributes since the last `fn`
+  for (let i = 0; i < toks.length; i++) {
+    const t = toks[i];
+    if (t.v === '@') { attrs.push(toks[i + 1].v); continue; }
+    if (t.k !== 'id' || toks[i - 1]?.v === '@') continue;
+    if (t.v === 'let' || t.v === 'var' || t.v === 'const' || t.v === 'override' || t.v === 'struct' || t.v === 'fn') {
+      let j = i + 1;
+      if (toks[j].v === '<') { while (toks[j].v !== '>') j++; j++; } // var<storage, ...>
+      const name = toks[j].v;
+      declared.add(name);
+      if (t.v === 'override' || (t.v === 'fn' && attrs.some(a => STAGES.has(a)))) keep.add(name);
+      // Parameters and struct members: `name:` up to the closing bracket
+      if (t.v === 'fn' || t.v === 'struct') {
+        let depth = 0;
+        for (let k = j + 1; k < toks.length; k++) {
+          if (toks[k].v === '(' || toks[k].v === '{') depth++;
+          if (toks[k].v === ')' || toks[k].v === '}') if (--depth === 0) break;
+          if (depth === 1 && toks[k].k === 'id' && toks[k + 1].v === ':') declared.add(toks[k].v);
+        }
+      }
+      if (t.v === 'fn') attrs = [];
+    }
+  }
+  const counts = new Map();
+  const taken = new Set(RESERVED);
+  for (const t of toks) {
+    if (t.k !== 'id') continue;
+    if (declared.has(t.v) && !keep.has(t.v)) counts.set(t.v, (counts.get(t.v) || 0) + 1);
+    else taken.add(t.v);
+  }
+  const renames = new Map();
+  let n = 0;
+  for (const [name] of [...counts].sort((a, b) => b[1] - a[1])) {
+    let short;
+    do short = shortName(n++); while (taken.has(short));
+    renames.set(name, short);
+  }
+  return renames;
+}
+
+const FIRST = 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ';
+const REST = FIRST + '0123456789';
+
+function shortName(n) {
+  let s = FIRST[n % FIRST.length];
+  for (n = Math.floor(n / FIRST.length); n > 0; n = Math.floor((n - 1) / REST.length)) s += REST[(n - 1) % REST.length];
+  return s;
+}
+
+// `1.50` → `1.5`, `0.5` → `.5`, `2.0` → `2.`
+function trimNumber(v) {
+  const m = /^(\d+)\.(\d*?)0*([fh]?)$/.exec(v);
+  if (!m) return v;
+  if (m[1] === '0' && m[2]) return `.${m[2]}${m[3]}`;
+  return `${m[1]}.${m[2]}${m[3]}`;
+}
+
+// Parentheses at `i` around one identifier or literal, other than an
+// argument list (after a name or a template) or an attribute argument. Not
+// before `<`: `(a) < b` must not turn into a template list `a<b ... >`.
+function redundantParens(toks, i) {
+  const prev = toks[i - 1];
+  if (prev && (prev.v === '>' || prev.v === ')' || prev.v === ']' ||
+      (prev.k === 'id' && !['if', 'while', 'return', 'switch'].includes(prev.v)))) return false;
+  return toks[i + 1]?.k !== 'punct' && toks[i + 2]?.v === ')' && toks[i + 3]?.v !== '<';
+}